@@ -0,0 +1,89 @@
+#include "cache.hpp"
+#include "polynomial.hpp"
+#include <algorithm>
+#include <cctype>
+#include <set>
+#include <stdexcept>
+
+ExpressionCache::ExpressionCache(size_t capacity) : capacity_(capacity) {
+    if (capacity_ == 0) {
+        throw std::invalid_argument("Cache capacity must be positive");
+    }
+}
+
+std::string ExpressionCache::normalize(const std::string& source) {
+    std::string result;
+    result.reserve(source.size());
+    for (char c : source) {
+        if (!std::isspace(static_cast<unsigned char>(c))) {
+            result += c;
+        }
+    }
+    return result;
+}
+
+std::shared_ptr<const CachedFormula> ExpressionCache::get(const std::string& source,
+                                                          const std::vector<std::string>& diff_variables) {
+    // Набор переменных не зависит от порядка и повторов
+    std::set<std::string> unique(diff_variables.begin(), diff_variables.end());
+    std::vector<std::string> variables(unique.begin(), unique.end());
+    std::string normalized = normalize(source);
+    std::string key = normalized + '\n';
+    for (const std::string& variable : variables) {
+        key += variable + ',';
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto iter = index_.find(key);
+        if (iter != index_.end()) {
+            ++stats_.hits;
+            entries_.splice(entries_.begin(), entries_, iter->second); // Перемещаем в начало списка
+            return iter->second->second;
+        }
+        ++stats_.misses;
+    }
+
+    // Разбор и дифференцирование выполняются без блокировки
+    std::shared_ptr<const CachedFormula> formula = build(normalized, variables);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto iter = index_.find(key);
+    if (iter != index_.end()) {
+        return iter->second->second; // Другой поток успел добавить ту же формулу
+    }
+    entries_.emplace_front(key, formula);
+    index_.emplace(key, entries_.begin());
+    while (entries_.size() > capacity_) {
+        index_.erase(entries_.back().first);
+        entries_.pop_back();
+        ++stats_.evictions;
+    }
+    return formula;
+}
+
+ExpressionCache::Stats ExpressionCache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats result = stats_;
+    result.size = entries_.size();
+    return result;
+}
+
+void ExpressionCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    index_.clear();
+}
+
+std::shared_ptr<const CachedFormula> ExpressionCache::build(const std::string& source,
+                                                            const std::vector<std::string>& diff_variables) {
+    Expression<double> expression = Expression<double>::from_string(source);
+    Expression<double> simplified = expression.simplify();
+    auto formula = std::make_shared<CachedFormula>(CachedFormula{expression, simplified, CompiledExpression<double>(simplified), {}, {}});
+    for (const std::string& variable : diff_variables) {
+        Expression<double> derivative = normal_form_diff(expression, variable);
+        formula->derivatives.emplace(variable, derivative);
+        formula->compiled_derivatives.emplace(variable, CompiledExpression<double>(derivative));
+    }
+    return formula;
+}
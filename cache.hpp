@@ -0,0 +1,62 @@
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+#include "expression.hpp"
+#include "compiled.hpp"
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Разобранная формула вместе с производными артефактами
+struct CachedFormula {
+    Expression<double> expression;       // Результат разбора
+    Expression<double> simplified;       // Упрощённое выражение
+    CompiledExpression<double> compiled; // Скомпилированное упрощённое выражение
+    std::map<std::string, Expression<double>> derivatives;                // Упрощённые производные по переменным
+    std::map<std::string, CompiledExpression<double>> compiled_derivatives; // Скомпилированные производные
+};
+
+// Потокобезопасный LRU-кэш разобранных, упрощённых и продифференцированных формул.
+// Ключ — нормализованная строка формулы и набор переменных дифференцирования
+class ExpressionCache {
+public:
+    // Счётчики кэша
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+        size_t size = 0;
+    };
+
+    explicit ExpressionCache(size_t capacity = 4096);
+
+    // Возвращает артефакты формулы, при промахе разбирает, дифференцирует и компилирует её.
+    // Ошибки разбора не кэшируются и пробрасываются вызывающему
+    std::shared_ptr<const CachedFormula> get(const std::string& source,
+                                             const std::vector<std::string>& diff_variables = {});
+
+    Stats stats() const;
+    size_t capacity() const { return capacity_; }
+    void clear();
+
+    // Нормализованная запись формулы: без пробельных символов
+    static std::string normalize(const std::string& source);
+
+private:
+    using Entry = std::pair<std::string, std::shared_ptr<const CachedFormula>>;
+
+    static std::shared_ptr<const CachedFormula> build(const std::string& source,
+                                                      const std::vector<std::string>& diff_variables);
+
+    size_t capacity_;
+    mutable std::mutex mutex_;
+    std::list<Entry> entries_; // От недавно использованных к давно использованным
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    Stats stats_;
+};
+
+#endif // CACHE_HPP
@@ -0,0 +1,318 @@
+#include "columnar.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+const char kNpyMagic[] = "\x93NUMPY";
+const size_t kNpyMagicLength = 6;
+
+std::string system_error(const std::string& what, const std::string& path) {
+    return what + " \"" + path + "\": " + std::strerror(errno);
+}
+
+// Значение ключа словаря заголовка .npy, например 'descr': '<f8'
+std::string npy_field(const std::string& header, const std::string& key) {
+    size_t pos = header.find("'" + key + "'");
+    if (pos == std::string::npos) {
+        throw std::runtime_error("Malformed .npy header: missing " + key);
+    }
+    pos = header.find(':', pos);
+    size_t end = pos;
+    int depth = 0;
+    while (++end < header.size()) {
+        char c = header[end];
+        if (c == '(') {
+            ++depth;
+        } else if (c == ')') {
+            --depth;
+        } else if ((c == ',' || c == '}') && depth == 0) {
+            break;
+        }
+    }
+    std::string value = header.substr(pos + 1, end - pos - 1);
+    value.erase(0, value.find_first_not_of(" '"));
+    value.erase(value.find_last_not_of(" '") + 1);
+    return value;
+}
+
+// Размеры массива из значения 'shape', например (5000,) или (5000, 1)
+std::vector<size_t> npy_shape(const std::string& shape, const std::string& path) {
+    auto malformed = [&path]() { return std::runtime_error("Malformed .npy shape in \"" + path + "\""); };
+    if (shape.size() < 2 || shape.front() != '(' || shape.back() != ')') {
+        throw malformed();
+    }
+    std::vector<size_t> dims;
+    std::stringstream items(shape.substr(1, shape.size() - 2));
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        item.erase(0, item.find_first_not_of(' '));
+        item.erase(item.find_last_not_of(' ') + 1);
+        if (item.empty()) {
+            break; // Завершающая запятая кортежа из одного элемента
+        }
+        if (item.find_first_not_of("0123456789") != std::string::npos) {
+            throw malformed();
+        }
+        dims.push_back(std::stoull(item));
+    }
+    if (std::getline(items, item, ',')) {
+        throw malformed(); // Пустой элемент в середине кортежа
+    }
+    return dims;
+}
+
+// Отображает файл целиком; для пустого файла возвращает nullptr
+void* map_file(int fd, size_t size, int protection, const std::string& path) {
+    if (size == 0) {
+        return nullptr;
+    }
+    void* mapping = mmap(nullptr, size, protection, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error(system_error("Cannot map", path));
+    }
+    return mapping;
+}
+
+bool ends_with(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+} // namespace
+
+MappedColumn::MappedColumn(const std::string& path) : path_(path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error(system_error("Cannot open", path));
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        ::close(fd);
+        throw std::runtime_error(system_error("Cannot stat", path));
+    }
+    mapping_size_ = static_cast<size_t>(info.st_size);
+    try {
+        mapping_ = map_file(fd, mapping_size_, PROT_READ, path);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+
+    try {
+        parse_layout();
+    } catch (...) {
+        if (mapping_) {
+            munmap(mapping_, mapping_size_);
+        }
+        throw;
+    }
+    if (mapping_) {
+        madvise(mapping_, mapping_size_, MADV_SEQUENTIAL); // Чтение строго последовательное
+    }
+}
+
+void MappedColumn::parse_layout() {
+    const std::string& path = path_;
+    const char* bytes = static_cast<const char*>(mapping_);
+    size_t offset = 0;
+    size_t declared = 0;
+    bool npy = false;
+    if (mapping_size_ >= kNpyMagicLength && std::memcmp(bytes, kNpyMagic, kNpyMagicLength) == 0) {
+        npy = true;
+        // Заголовок .npy: версия, длина заголовка (2 байта в версии 1, 4 байта в версиях 2 и 3), словарь
+        if (mapping_size_ < 10) {
+            throw std::runtime_error("Truncated .npy file \"" + path + "\"");
+        }
+        unsigned char major = static_cast<unsigned char>(bytes[6]);
+        if (major < 1 || major > 3) {
+            throw std::runtime_error("Unsupported .npy version " + std::to_string(major) + " in \"" + path + "\"");
+        }
+        size_t prefix = major == 1 ? 10 : 12; // Магия, версия и длина заголовка
+        if (mapping_size_ < prefix) {
+            throw std::runtime_error("Truncated .npy file \"" + path + "\"");
+        }
+        const unsigned char* length = reinterpret_cast<const unsigned char*>(bytes + 8);
+        size_t header_length = major == 1 ? length[0] | (length[1] << 8)
+                                          : length[0] | (length[1] << 8) | (length[2] << 16) | (size_t(length[3]) << 24);
+        offset = prefix + header_length;
+        if (offset > mapping_size_) {
+            throw std::runtime_error("Truncated .npy file \"" + path + "\"");
+        }
+        std::string header(bytes + prefix, header_length);
+        std::string descr = npy_field(header, "descr");
+        if (descr == "<f4") {
+            single_ = true;
+        } else if (descr != "<f8") {
+            throw std::runtime_error("Unsupported .npy dtype " + descr + " in \"" + path + "\"");
+        }
+        // Порядок хранения не важен только для одномерных массивов: (N,) или (N, 1)
+        std::vector<size_t> dims = npy_shape(npy_field(header, "shape"), path);
+        if (dims.empty() || dims.size() > 2 || (dims.size() == 2 && dims[1] != 1)) {
+            throw std::runtime_error("Only one-dimensional .npy columns are supported: \"" + path + "\"");
+        }
+        declared = dims[0];
+    }
+
+    size_t element = single_ ? sizeof(float) : sizeof(double);
+    if ((mapping_size_ - offset) % element != 0 || offset % element != 0) {
+        throw std::runtime_error("Column file size is not a multiple of the element size: \"" + path + "\"");
+    }
+    size_ = (mapping_size_ - offset) / element;
+    if (npy && size_ != declared) {
+        throw std::runtime_error(".npy shape declares " + std::to_string(declared) + " values but \"" + path + "\" holds " +
+                                 std::to_string(size_));
+    }
+    data_ = bytes + offset;
+}
+
+MappedColumn::MappedColumn(MappedColumn&& other) noexcept
+    : path_(std::move(other.path_)), mapping_(other.mapping_), mapping_size_(other.mapping_size_), data_(other.data_),
+      size_(other.size_), single_(other.single_) {
+    other.mapping_ = nullptr;
+    other.mapping_size_ = 0;
+}
+
+MappedColumn::~MappedColumn() {
+    if (mapping_) {
+        munmap(mapping_, mapping_size_);
+    }
+}
+
+void MappedColumn::prefetch(size_t begin, size_t end) const {
+    advise(begin, end, MADV_WILLNEED);
+}
+
+void MappedColumn::release(size_t begin, size_t end) const {
+    advise(begin, end, MADV_DONTNEED); // Страницы файла остаются в кэше ядра, но не в рабочем наборе процесса
+}
+
+void MappedColumn::advise(size_t begin, size_t end, int advice) const {
+    if (!mapping_ || begin >= end) {
+        return;
+    }
+    size_t element = single_ ? sizeof(float) : sizeof(double);
+    const char* base = static_cast<const char*>(mapping_);
+    const char* first = static_cast<const char*>(data_) + begin * element;
+    const char* last = static_cast<const char*>(data_) + std::min(end, size_) * element;
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t from = (first - base) / page * page; // Границы выравниваются по страницам
+    size_t to = std::min(mapping_size_, (last - base + page - 1) / page * page);
+    if (advice == MADV_DONTNEED) {
+        to = (last - base) / page * page; // Освобождаются только страницы, целиком обработанные
+    }
+    if (from < to) {
+        madvise(const_cast<char*>(base) + from, to - from, advice);
+    }
+}
+
+void ColumnarBatch::bind(const std::string& variable, const std::string& path) {
+    columns_.erase(variable);
+    columns_.emplace(variable, MappedColumn(path));
+}
+
+ColumnarBatch::Report ColumnarBatch::evaluate(const CompiledExpression<double>& program, const std::string& output_path,
+                                              size_t chunk_points) const {
+    auto started = std::chrono::steady_clock::now();
+    if (chunk_points == 0) {
+        throw std::invalid_argument("Chunk size must be positive");
+    }
+
+    // Столбцы в порядке переменных программы
+    std::vector<const MappedColumn*> inputs;
+    for (const std::string& variable : program.variables()) {
+        auto iter = columns_.find(variable);
+        if (iter == columns_.end()) {
+            throw std::runtime_error("Variable \"" + variable + "\" is not bound to a column");
+        }
+        inputs.push_back(&iter->second);
+    }
+    size_t points = inputs.empty() ? (columns_.empty() ? 0 : columns_.begin()->second.size()) : inputs.front()->size();
+    for (const MappedColumn* column : inputs) {
+        if (column->size() != points) {
+            throw std::runtime_error("Column \"" + column->path() + "\" has " + std::to_string(column->size()) +
+                                     " rows, expected " + std::to_string(points));
+        }
+    }
+
+    // Заголовок .npy дополняется пробелами так, чтобы данные начинались с границы 64 байт
+    std::string header;
+    if (ends_with(output_path, ".npy")) {
+        std::string dict = "{'descr': '<f8', 'fortran_order': False, 'shape': (" + std::to_string(points) + ",), }";
+        size_t total = (10 + dict.size() + 1 + 63) / 64 * 64;
+        dict.append(total - 10 - dict.size() - 1, ' ');
+        dict += '\n';
+        header = std::string(kNpyMagic, kNpyMagicLength) + '\x01' + '\x00';
+        header += static_cast<char>(dict.size() & 0xff);
+        header += static_cast<char>(dict.size() >> 8);
+        header += dict;
+    }
+    size_t file_size = header.size() + points * sizeof(double);
+
+    int fd = ::open(output_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error(system_error("Cannot create", output_path));
+    }
+    if (ftruncate(fd, static_cast<off_t>(file_size)) != 0) {
+        ::close(fd);
+        throw std::runtime_error(system_error("Cannot resize", output_path));
+    }
+    void* mapping;
+    try {
+        mapping = map_file(fd, file_size, PROT_READ | PROT_WRITE, output_path);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+    if (mapping) {
+        std::memcpy(mapping, header.data(), header.size());
+        madvise(mapping, file_size, MADV_SEQUENTIAL);
+    }
+    double* output = reinterpret_cast<double*>(static_cast<char*>(mapping) + header.size());
+
+    try {
+        std::vector<std::vector<double>> converted(inputs.size()); // Части столбцов float, приведённые к double
+        std::vector<const double*> columns(inputs.size());
+        for (size_t start = 0; start < points; start += chunk_points) {
+            size_t count = std::min(chunk_points, points - start);
+            for (size_t v = 0; v < inputs.size(); ++v) {
+                const MappedColumn& column = *inputs[v];
+                column.prefetch(start + count, start + 2 * count); // Следующая часть читается, пока считается текущая
+                if (column.single_precision()) {
+                    converted[v].assign(column.floats() + start, column.floats() + start + count);
+                    columns[v] = converted[v].data();
+                } else {
+                    columns[v] = column.doubles() + start;
+                }
+            }
+            program.eval_batch(columns, output + start, count);
+            for (const MappedColumn* column : inputs) {
+                column->release(start, start + count);
+            }
+        }
+    } catch (...) {
+        if (mapping) {
+            munmap(mapping, file_size);
+        }
+        throw;
+    }
+    if (mapping) {
+        msync(mapping, file_size, MS_ASYNC); // Запись на диск продолжается в фоне
+        munmap(mapping, file_size);
+    }
+
+    Report report;
+    report.points = points;
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    return report;
+}
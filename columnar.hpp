@@ -0,0 +1,64 @@
+#ifndef COLUMNAR_HPP
+#define COLUMNAR_HPP
+
+#include "compiled.hpp"
+#include <map>
+#include <string>
+#include <vector>
+
+// Столбец чисел из файла, отображённого в память: сырые double или одномерный .npy (<f8 или <f4)
+class MappedColumn {
+public:
+    explicit MappedColumn(const std::string& path);
+    ~MappedColumn();
+
+    MappedColumn(MappedColumn&& other) noexcept;
+    MappedColumn& operator=(MappedColumn&&) = delete;
+    MappedColumn(const MappedColumn&) = delete;
+    MappedColumn& operator=(const MappedColumn&) = delete;
+
+    const std::string& path() const { return path_; }
+    size_t size() const { return size_; }                  // Число элементов
+    bool single_precision() const { return single_; }      // Элементы типа float
+    const double* doubles() const { return static_cast<const double*>(data_); }
+    const float* floats() const { return static_cast<const float*>(data_); }
+
+    // Подсказки ядру: заранее прочитать элементы [begin, end) и освободить уже обработанные
+    void prefetch(size_t begin, size_t end) const;
+    void release(size_t begin, size_t end) const;
+
+private:
+    void parse_layout(); // Заголовок .npy, тип и число значений; бросает исключение при несоответствии
+    void advise(size_t begin, size_t end, int advice) const;
+
+    std::string path_;
+    void* mapping_ = nullptr;
+    size_t mapping_size_ = 0;
+    const void* data_ = nullptr;
+    size_t size_ = 0;
+    bool single_ = false;
+};
+
+// Пакетное вычисление над столбцами в файлах: столбцы привязываются к переменным по имени,
+// читаются через отображение в память частями и не загружаются в память целиком;
+// результат пишется в отображённый в память выходной файл (сырые double или .npy по расширению)
+class ColumnarBatch {
+public:
+    // Итог вычисления
+    struct Report {
+        size_t points = 0;
+        double seconds = 0;
+    };
+
+    // Привязывает файл столбца к переменной
+    void bind(const std::string& variable, const std::string& path);
+
+    // Вычисляет первый выход программы для всех строк; chunk_points — число точек в одной части
+    Report evaluate(const CompiledExpression<double>& program, const std::string& output_path,
+                    size_t chunk_points = 1 << 20) const;
+
+private:
+    std::map<std::string, MappedColumn> columns_;
+};
+
+#endif // COLUMNAR_HPP
@@ -0,0 +1,856 @@
+#ifndef COMPILED_HPP
+#define COMPILED_HPP
+
+#include "expression.hpp"
+#include "polynomial.hpp"
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Скомпилированное выражение: плоская последовательность инструкций вместо обхода дерева.
+// Полиномиальные и рациональные подвыражения вычисляются по схеме Горнера с FMA,
+// целые степени раскрываются в цепочки умножений, общие подвыражения вычисляются один раз.
+// Инструкции упорядочиваются так, чтобы одновременно жило как можно меньше значений,
+// а слоты значений, которые больше не понадобятся, переиспользуются
+template<typename T>
+class CompiledExpression {
+public:
+    // Коды инструкций
+    enum class OpCode : unsigned char { Const, Var, Add, Sub, Mul, Div, Pow, Fma, Sin, Cos, Ln, Exp };
+
+    // Инструкция: результат записывается в слот dst; он никогда не совпадает со слотами операндов
+    struct Instruction {
+        OpCode op;
+        unsigned a, b, c; // Номера слотов операндов (для Var в a — номер переменной)
+        T constant;       // Значение для Const
+        unsigned dst;     // Слот результата
+    };
+
+    // Число точек, обрабатываемых за один проход по инструкциям при пакетном вычислении
+    static constexpr size_t kBlockSize = 256;
+
+    // Компиляция выражения; use_polynomials включает распознавание полиномов
+    explicit CompiledExpression(const Expression<T>& expr, bool use_polynomials = true)
+        : CompiledExpression(std::vector<Expression<T>>{expr}, use_polynomials) {}
+
+    // Компиляция нескольких выражений в одну программу: общие подвыражения разных выходов вычисляются один раз
+    explicit CompiledExpression(const std::vector<Expression<T>>& outputs, bool use_polynomials = true) {
+        Compiler compiler(*this, use_polynomials);
+        for (const Expression<T>& output : outputs) {
+            results_.push_back(compiler.emit(output));
+        }
+        allocate_slots();
+    }
+
+    // Сборка из готовой программы (например, прочитанной из разделяемой памяти); программа проверяется
+    CompiledExpression(std::vector<std::string> variables, std::vector<Instruction> instructions,
+                       std::vector<unsigned> results, size_t slots)
+        : variables_(std::move(variables)), instructions_(std::move(instructions)), results_(std::move(results)),
+          slot_count_(slots) {
+        for (const Instruction& ins : instructions_) {
+            bool valid = ins.dst < slot_count_ && static_cast<unsigned>(ins.op) <= static_cast<unsigned>(OpCode::Exp);
+            for (size_t k = 0; valid && k < arity(ins.op); ++k) {
+                valid = (k == 0 ? ins.a : k == 1 ? ins.b : ins.c) < slot_count_;
+            }
+            if (valid && ins.op == OpCode::Var) {
+                valid = ins.a < variables_.size();
+            }
+            if (!valid) {
+                throw std::invalid_argument("Malformed compiled program");
+            }
+        }
+        for (unsigned result : results_) {
+            if (result >= slot_count_) {
+                throw std::invalid_argument("Malformed compiled program");
+            }
+        }
+        if (results_.empty()) {
+            throw std::invalid_argument("Compiled program has no outputs");
+        }
+    }
+
+    // Переменные в порядке, в котором пакетное вычисление ожидает столбцы
+    const std::vector<std::string>& variables() const { return variables_; }
+    const std::vector<Instruction>& instructions() const { return instructions_; }
+    const std::vector<unsigned>& result_slots() const { return results_; }
+    size_t outputs() const { return results_.size(); }
+    size_t slots() const { return slot_count_; } // Рабочая память на одну точку, в значениях T
+
+    // Вычисление первого выхода в одной точке
+    T eval(const std::map<std::string, T>& context) const {
+        return eval_all(context).front();
+    }
+
+    // Вычисление всех выходов в одной точке
+    std::vector<T> eval_all(const std::map<std::string, T>& context) const {
+        std::vector<T> inputs = gather(context);
+        std::vector<T> scratch(slot_count_);
+        run_scalar(inputs, scratch);
+        std::vector<T> result;
+        for (unsigned slot : results_) {
+            result.push_back(scratch[slot]);
+        }
+        return result;
+    }
+
+    // Прямой режим дифференцирования сразу по directions направлениям.
+    // seeds[v * directions + k] — k-я компонента направления для переменной variables()[v];
+    // в tangents[o * directions + k] записывается производная выхода o по k-му направлению
+    std::vector<T> eval_directional(const std::map<std::string, T>& context, const std::vector<T>& seeds,
+                                    size_t directions, std::vector<T>& tangents) const {
+        if (seeds.size() != variables_.size() * directions) {
+            throw std::invalid_argument("Expected " + std::to_string(variables_.size() * directions) + " seed values");
+        }
+        std::vector<T> inputs = gather(context);
+        std::vector<const T*> columns = point_columns(inputs);
+        std::vector<T> values(slot_count_);
+        std::vector<T> derivatives(slot_count_ * directions);
+        for (const Instruction& ins : instructions_) {
+            step(ins, values.data(), 1, columns.data(), 0, 1);
+            // Поля a, b, c — слоты только для настоящих операндов; у Var в a номер переменной
+            size_t n = arity(ins.op);
+            T* dst = derivatives.data() + ins.dst * directions;
+            const T* da = n > 0 ? derivatives.data() + ins.a * directions : nullptr;
+            const T* db = n > 1 ? derivatives.data() + ins.b * directions : nullptr;
+            const T* dc = n > 2 ? derivatives.data() + ins.c * directions : nullptr;
+            const T a = n > 0 ? values[ins.a] : T(0);
+            const T b = n > 1 ? values[ins.b] : T(0);
+            const T& v = values[ins.dst];
+            switch (ins.op) {
+            case OpCode::Const:
+                std::fill(dst, dst + directions, T(0));
+                break;
+            case OpCode::Var:
+                std::copy(seeds.begin() + ins.a * directions, seeds.begin() + (ins.a + 1) * directions, dst);
+                break;
+            case OpCode::Add:
+                for (size_t k = 0; k < directions; ++k) dst[k] = da[k] + db[k];
+                break;
+            case OpCode::Sub:
+                for (size_t k = 0; k < directions; ++k) dst[k] = da[k] - db[k];
+                break;
+            case OpCode::Mul:
+                for (size_t k = 0; k < directions; ++k) dst[k] = da[k] * b + a * db[k];
+                break;
+            case OpCode::Div:
+                for (size_t k = 0; k < directions; ++k) dst[k] = (da[k] - v * db[k]) / b;
+                break;
+            case OpCode::Pow:
+                // Слагаемые с нулевым приращением пропускаются: для постоянного показателя не нужен ln(основания)
+                for (size_t k = 0; k < directions; ++k) {
+                    T d(0);
+                    if (da[k] != T(0)) d += b * fast_pow(a, b - T(1)) * da[k];
+                    if (db[k] != T(0)) d += v * std::log(a) * db[k];
+                    dst[k] = d;
+                }
+                break;
+            case OpCode::Fma:
+                for (size_t k = 0; k < directions; ++k) dst[k] = da[k] * b + a * db[k] + dc[k];
+                break;
+            case OpCode::Sin:
+                for (size_t k = 0; k < directions; ++k) dst[k] = std::cos(a) * da[k];
+                break;
+            case OpCode::Cos:
+                for (size_t k = 0; k < directions; ++k) dst[k] = -std::sin(a) * da[k];
+                break;
+            case OpCode::Ln:
+                for (size_t k = 0; k < directions; ++k) dst[k] = da[k] / a;
+                break;
+            case OpCode::Exp:
+                for (size_t k = 0; k < directions; ++k) dst[k] = v * da[k];
+                break;
+            }
+        }
+
+        std::vector<T> result;
+        tangents.assign(results_.size() * directions, T(0));
+        for (size_t o = 0; o < results_.size(); ++o) {
+            result.push_back(values[results_[o]]);
+            std::copy(derivatives.begin() + results_[o] * directions, derivatives.begin() + (results_[o] + 1) * directions,
+                      tangents.begin() + o * directions);
+        }
+        return result;
+    }
+
+    // Пакетное вычисление первого выхода: columns[i] — значения переменной variables()[i] в count точках
+    void eval_batch(const std::vector<const T*>& columns, T* out, size_t count) const {
+        eval_batch(columns, std::vector<T*>{out}, count);
+    }
+
+    // Пакетное вычисление нескольких выходов: outputs[o] получает значения выхода o
+    void eval_batch(const std::vector<const T*>& columns, const std::vector<T*>& outputs, size_t count) const {
+        if (columns.size() != variables_.size()) {
+            throw std::invalid_argument("Expected " + std::to_string(variables_.size()) + " input columns");
+        }
+        std::vector<T> scratch(slot_count_ * kBlockSize);
+        for (size_t start = 0; start < count; start += kBlockSize) {
+            size_t lanes = std::min(kBlockSize, count - start);
+            execute(scratch.data(), kBlockSize, columns.data(), start, lanes);
+            for (size_t o = 0; o < outputs.size() && o < results_.size(); ++o) {
+                auto first = scratch.begin() + results_[o] * kBlockSize;
+                std::copy(first, first + lanes, outputs[o] + start);
+            }
+        }
+    }
+
+    // Пакетное вычисление первого выхода с оценкой абсолютной погрешности.
+    // Оценка строится бегущим анализом ошибок округления сразу для блока из kBlockSize точек:
+    // для каждого слота хранятся диапазон значений в блоке и общая для блока граница погрешности,
+    // и каждая операция добавляет погрешность своего округления к распространённым погрешностям операндов.
+    // Так анализ стоит несколько действий на инструкцию, а не на точку; всем точкам блока
+    // достаётся худшая по блоку оценка. Столбцы могут быть и точнее T (double для программы во float):
+    // значения приводятся к T при загрузке, и погрешность этого округления входит в оценку.
+    // Для непредставимых результатов оценка бесконечна; деление на ноль здесь не бросает исключение,
+    // а даёт бесконечную оценку
+    template<typename U>
+    void eval_batch_with_error(const std::vector<const U*>& columns, T* out, T* errors, size_t count) const {
+        if (columns.size() != variables_.size()) {
+            throw std::invalid_argument("Expected " + std::to_string(variables_.size()) + " input columns");
+        }
+        std::vector<T> scratch(slot_count_ * kBlockSize);
+        std::vector<ErrorRange> ranges(slot_count_);
+        for (size_t start = 0; start < count; start += kBlockSize) {
+            size_t lanes = std::min(kBlockSize, count - start);
+            execute(scratch.data(), kBlockSize, columns.data(), start, lanes, ranges.data());
+            // Конечный диапазон результата содержит все значения блока, так что они тоже конечны
+            auto first = scratch.begin() + results_.front() * kBlockSize;
+            std::copy(first, first + lanes, out + start);
+            std::fill(errors + start, errors + start + lanes, ranges[results_.front()].error);
+        }
+    }
+
+    // Та же программа с другим типом значений (например, float из double)
+    template<typename U>
+    CompiledExpression<U> cast() const {
+        CompiledExpression<U> result;
+        result.variables_ = variables_;
+        result.results_ = results_;
+        result.slot_count_ = slot_count_;
+        for (const Instruction& ins : instructions_) {
+            result.instructions_.push_back({static_cast<typename CompiledExpression<U>::OpCode>(ins.op),
+                                            ins.a, ins.b, ins.c, static_cast<U>(ins.constant), ins.dst});
+        }
+        return result;
+    }
+
+private:
+    template<typename> friend class CompiledExpression;
+
+    CompiledExpression() = default;
+
+    // Диапазон значений слота в блоке точек и граница абсолютной погрешности, общая для блока
+    struct ErrorRange {
+        T lo, hi, error;
+
+        T magnitude() const { return std::max(std::abs(lo), std::abs(hi)); }
+        T min_magnitude() const { return lo > 0 ? lo : hi < 0 ? -hi : T(0); }
+    };
+
+    // Оценка погрешности результата инструкции по диапазонам и оценкам её операндов (только для float и double).
+    // Диапазоны значений расширяются с запасом на округление, поэтому оценки по модулям остаются верхними;
+    // values — уже вычисленные значения результата в lanes точках
+    void propagate_error(const Instruction& ins, ErrorRange* ranges, const T* values, size_t lanes) const {
+        static_assert(std::is_floating_point_v<T>, "Error bounds are defined for real types only");
+        const T u = std::numeric_limits<T>::epsilon() / 2;     // Единица округления
+        const T inf = std::numeric_limits<T>::infinity();
+        const T largest = std::numeric_limits<T>::max();
+        size_t n = arity(ins.op);
+        const ErrorRange a = n > 0 ? ranges[ins.a] : ErrorRange{};
+        const ErrorRange b = n > 1 ? ranges[ins.b] : ErrorRange{};
+        ErrorRange r{-inf, inf, inf};
+        auto hull = [&r](std::initializer_list<T> values) {
+            r.lo = std::min(values);
+            r.hi = std::max(values);
+        };
+        switch (ins.op) {
+        case OpCode::Const:
+            r = {ins.constant, ins.constant, u * std::abs(ins.constant)};
+            break;
+        case OpCode::Var:
+            r = value_range(values, lanes);
+            r.error = u * r.magnitude();
+            break;
+        case OpCode::Add:
+            r = {a.lo + b.lo, a.hi + b.hi, 0};
+            r.error = a.error + b.error + u * r.magnitude();
+            break;
+        case OpCode::Sub:
+            r = {a.lo - b.hi, a.hi - b.lo, 0};
+            r.error = a.error + b.error + u * r.magnitude();
+            break;
+        case OpCode::Mul:
+            hull({a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi});
+            r.error = a.magnitude() * b.error + b.magnitude() * a.error + a.error * b.error + u * r.magnitude();
+            break;
+        case OpCode::Fma: {
+            const ErrorRange& c = ranges[ins.c];
+            hull({a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi});
+            r.lo += c.lo;
+            r.hi += c.hi;
+            r.error = a.magnitude() * b.error + b.magnitude() * a.error + a.error * b.error + c.error + u * r.magnitude();
+            break;
+        }
+        case OpCode::Div:
+            if (b.min_magnitude() > b.error) {
+                hull({a.lo / b.lo, a.lo / b.hi, a.hi / b.lo, a.hi / b.hi});
+                r.error = (a.error + r.magnitude() * b.error) / (b.min_magnitude() - b.error) + u * r.magnitude();
+            }
+            break;
+        case OpCode::Pow: {
+            // Целые степени считаются цепочкой умножений: до |n| + 1 округлений; при положительном основании
+            // степень монотонна по обоим аргументам, и к погрешности добавляется вклад показателя
+            long long power;
+            if (b.lo == b.hi && b.error == 0 && is_integer_exponent(b.lo, power) &&
+                (power >= 0 || a.min_magnitude() > a.error)) {
+                T base = power >= 0 ? a.magnitude() : a.min_magnitude();
+                T magnitude = integer_power(base, power);
+                T relative = a.error == 0 ? T(0) : a.min_magnitude() > a.error
+                                 ? std::abs(T(power)) * a.error / (a.min_magnitude() - a.error) : inf;
+                r = {-magnitude, magnitude, magnitude * relative + (std::abs(T(power)) + 2) * u * magnitude};
+            } else if (a.lo > a.error) {
+                hull({std::pow(a.lo, b.lo), std::pow(a.lo, b.hi), std::pow(a.hi, b.lo), std::pow(a.hi, b.hi)});
+                T log_magnitude = std::max(std::abs(std::log(a.lo - a.error)), std::abs(std::log(a.hi + a.error)));
+                T relative = b.magnitude() * a.error / (a.lo - a.error) + log_magnitude * b.error;
+                r.error = r.magnitude() * (relative + (std::max(b.magnitude(), T(1)) + 2) * u);
+            }
+            break;
+        }
+        case OpCode::Sin:
+        case OpCode::Cos:
+            // Функции библиотеки — до одной-двух единиц последнего разряда
+            r = {T(-1), T(1), a.error + 3 * u};
+            break;
+        case OpCode::Ln:
+            if (a.min_magnitude() > a.error) {
+                r = {std::log(a.min_magnitude()), std::log(a.magnitude()), 0};
+                r.error = a.error / (a.min_magnitude() - a.error) + 2 * u * r.magnitude();
+            }
+            break;
+        case OpCode::Exp:
+            // exp(t) - 1 <= t + t^2 при t <= 1
+            if (a.error <= 1) {
+                r = {std::exp(a.lo), std::exp(a.hi), 0};
+                r.error = r.hi * (a.error + a.error * a.error + 2 * u);
+            }
+            break;
+        }
+        // Запас на округление самих значений; непредставимый диапазон или NaN дают бесконечную оценку
+        r.lo -= r.error + u * std::abs(r.lo);
+        r.hi += r.error + u * std::abs(r.hi);
+        if (!(r.magnitude() <= largest && r.error <= largest)) {
+            r = {-inf, inf, inf};
+        }
+        ranges[ins.dst] = r;
+    }
+
+    // Диапазон значений в lanes точках; NaN или бесконечность дают неограниченный диапазон.
+    // Минимум и максимум ведутся по kWidth независимым дорожкам, чтобы цикл векторизовался
+    static ErrorRange value_range(const T* values, size_t lanes) {
+        constexpr size_t kWidth = 8;
+        T lo[kWidth], hi[kWidth], probe[kWidth] = {}; // probe — сумма v - v: ноль, пока значения конечны
+        std::fill(lo, lo + kWidth, values[0]);
+        std::fill(hi, hi + kWidth, values[0]);
+        size_t l = 0;
+        for (; l + kWidth <= lanes; l += kWidth) {
+            for (size_t k = 0; k < kWidth; ++k) {
+                lo[k] = values[l + k] < lo[k] ? values[l + k] : lo[k];
+                hi[k] = values[l + k] > hi[k] ? values[l + k] : hi[k];
+                probe[k] += values[l + k] - values[l + k];
+            }
+        }
+        for (; l < lanes; ++l) {
+            lo[0] = std::min(lo[0], values[l]);
+            hi[0] = std::max(hi[0], values[l]);
+            probe[0] += values[l] - values[l];
+        }
+        ErrorRange r{lo[0], hi[0], 0};
+        for (size_t k = 0; k < kWidth; ++k) {
+            r.lo = std::min(r.lo, lo[k]);
+            r.hi = std::max(r.hi, hi[k]);
+            r.error += probe[k];
+        }
+        if (r.error != 0) {
+            r = {-std::numeric_limits<T>::infinity(), std::numeric_limits<T>::infinity(), 0};
+        }
+        return r;
+    }
+
+    // Значения переменных из контекста в порядке variables()
+    std::vector<T> gather(const std::map<std::string, T>& context) const {
+        std::vector<T> inputs(variables_.size());
+        for (size_t i = 0; i < variables_.size(); ++i) {
+            auto iter = context.find(variables_[i]);
+            if (iter == context.end()) {
+                throw std::runtime_error("Variable \"" + variables_[i] + "\" not present in evaluation context");
+            }
+            inputs[i] = iter->second;
+        }
+        return inputs;
+    }
+
+    // Указатели на входные значения одной точки
+    static std::vector<const T*> point_columns(const std::vector<T>& inputs) {
+        std::vector<const T*> columns(inputs.size());
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            columns[i] = &inputs[i];
+        }
+        return columns;
+    }
+
+    // Выполняет программу в одной точке
+    void run_scalar(const std::vector<T>& inputs, std::vector<T>& scratch) const {
+        execute(scratch.data(), 1, point_columns(inputs).data(), 0, 1);
+    }
+
+    // Выполняет все инструкции для lanes точек; слот s занимает scratch[s * stride, s * stride + lanes).
+    // Если ranges не пусто, вместе со значениями вычисляются оценки погрешности блока, а деление на ноль
+    // отражается бесконечной оценкой вместо исключения
+    template<typename U>
+    void execute(T* scratch, size_t stride, const U* const* columns, size_t offset, size_t lanes,
+                 ErrorRange* ranges = nullptr) const {
+        for (const Instruction& ins : instructions_) {
+            if (std::is_floating_point_v<T> && lanes == kBlockSize) {
+                step<kBlockSize>(ins, scratch, stride, columns, offset, lanes, ranges == nullptr);
+            } else {
+                step(ins, scratch, stride, columns, offset, lanes, ranges == nullptr);
+            }
+            if constexpr (std::is_floating_point_v<T>) {
+                if (ranges) {
+                    propagate_error(ins, ranges, scratch + ins.dst * stride, lanes);
+                }
+            }
+        }
+    }
+
+    // Выполняет одну инструкцию для lanes точек; checked — бросать исключение при делении на ноль.
+    // Lanes != 0 — полный блок с известной при компиляции длиной; входные столбцы приводятся к T
+    template<size_t Lanes = 0, typename U>
+    void step(const Instruction& ins, T* scratch, size_t stride, const U* const* columns, size_t offset, size_t lanes,
+              bool checked = true) const {
+        size_t n = arity(ins.op);
+        T* dst = scratch + ins.dst * stride;
+        const T* a = n > 0 ? scratch + ins.a * stride : nullptr;
+        const T* b = n > 1 ? scratch + ins.b * stride : nullptr;
+        const T* c = n > 2 ? scratch + ins.c * stride : nullptr;
+        switch (ins.op) {
+        case OpCode::Const:
+            std::fill(dst, dst + lanes, ins.constant);
+            break;
+        case OpCode::Var: {
+            const U* column = columns[ins.a] + offset;
+            for_lanes<Lanes>(dst, lanes, [column](size_t l) { return static_cast<T>(column[l]); });
+            break;
+        }
+        case OpCode::Add:
+            for_lanes<Lanes>(dst, lanes, [a, b](size_t l) { return a[l] + b[l]; });
+            break;
+        case OpCode::Sub:
+            for_lanes<Lanes>(dst, lanes, [a, b](size_t l) { return a[l] - b[l]; });
+            break;
+        case OpCode::Mul:
+            for_lanes<Lanes>(dst, lanes, [a, b](size_t l) { return a[l] * b[l]; });
+            break;
+        case OpCode::Div:
+            if (checked && std::find(b, b + lanes, T(0)) != b + lanes) {
+                throw std::runtime_error("Division by zero");
+            }
+            for_lanes<Lanes>(dst, lanes, [a, b](size_t l) { return a[l] / b[l]; });
+            break;
+        case OpCode::Pow:
+            for_lanes<Lanes>(dst, lanes, [a, b](size_t l) { return fast_pow(a[l], b[l]); });
+            break;
+        case OpCode::Fma:
+            for_lanes<Lanes>(dst, lanes, [a, b, c](size_t l) { return fused_multiply_add(a[l], b[l], c[l]); });
+            break;
+        case OpCode::Sin:
+            for_lanes<Lanes>(dst, lanes, [a](size_t l) { return std::sin(a[l]); });
+            break;
+        case OpCode::Cos:
+            for_lanes<Lanes>(dst, lanes, [a](size_t l) { return std::cos(a[l]); });
+            break;
+        case OpCode::Ln:
+            for_lanes<Lanes>(dst, lanes, [a](size_t l) { return std::log(a[l]); });
+            break;
+        case OpCode::Exp:
+            for_lanes<Lanes>(dst, lanes, [a](size_t l) { return std::exp(a[l]); });
+            break;
+        }
+    }
+
+    // dst[l] = f(l) для lanes точек. Для полного блока значения собираются во временный массив:
+    // он не пересекается со слотами, а длина известна заранее, поэтому цикл векторизуется уже при -O2
+    template<size_t Lanes, typename F>
+    static void for_lanes(T* dst, size_t lanes, F f) {
+        if constexpr (Lanes != 0) {
+            T values[Lanes];
+            for (size_t l = 0; l < Lanes; ++l) values[l] = f(l);
+            std::copy(values, values + Lanes, dst);
+        } else {
+            for (size_t l = 0; l < lanes; ++l) dst[l] = f(l);
+        }
+    }
+
+    // Число операндов-слотов инструкции
+    static size_t arity(OpCode op) {
+        switch (op) {
+        case OpCode::Const:
+        case OpCode::Var:
+            return 0;
+        case OpCode::Add:
+        case OpCode::Sub:
+        case OpCode::Mul:
+        case OpCode::Div:
+        case OpCode::Pow:
+            return 2;
+        case OpCode::Fma:
+            return 3;
+        default:
+            return 1;
+        }
+    }
+
+    static unsigned& operand(Instruction& ins, size_t k) {
+        return k == 0 ? ins.a : k == 1 ? ins.b : ins.c;
+    }
+
+    // Планирование и распределение слотов. Инструкции переупорядочиваются обходом в глубину от выходов,
+    // причём операнд, требующий больше живых значений (число Сети — Ульмана), вычисляется первым;
+    // недостижимые инструкции отбрасываются. Затем по времени жизни значений слоты переиспользуются
+    void allocate_slots() {
+        size_t count = instructions_.size();
+        std::vector<size_t> need(count, 1);
+        for (size_t i = 0; i < count; ++i) {
+            Instruction& ins = instructions_[i];
+            std::vector<size_t> needs;
+            for (size_t k = 0; k < arity(ins.op); ++k) {
+                needs.push_back(need[operand(ins, k)]);
+            }
+            std::sort(needs.rbegin(), needs.rend());
+            for (size_t k = 0; k < needs.size(); ++k) {
+                need[i] = std::max(need[i], needs[k] + k);
+            }
+        }
+
+        std::vector<unsigned> order;                      // Новый порядок: старые номера инструкций
+        std::vector<unsigned> position(count, count);     // Новый номер по старому
+        for (unsigned result : results_) {
+            schedule(result, need, position, order);
+        }
+
+        // Последнее использование каждого значения; выходы живут до конца программы
+        std::vector<size_t> last_use(order.size(), 0);
+        for (size_t p = 0; p < order.size(); ++p) {
+            Instruction& ins = instructions_[order[p]];
+            for (size_t k = 0; k < arity(ins.op); ++k) {
+                last_use[position[operand(ins, k)]] = p;
+            }
+        }
+        for (unsigned& result : results_) {
+            result = position[result];
+            last_use[result] = order.size();
+        }
+
+        std::vector<Instruction> scheduled;
+        std::vector<unsigned> slot_of(order.size());
+        std::vector<unsigned> free_slots; // Освобождённые слоты; последний освобождённый берётся первым
+        slot_count_ = 0;
+        for (size_t p = 0; p < order.size(); ++p) {
+            Instruction ins = instructions_[order[p]];
+            if (free_slots.empty()) {
+                slot_of[p] = static_cast<unsigned>(slot_count_++);
+            } else {
+                slot_of[p] = free_slots.back();
+                free_slots.pop_back();
+            }
+            ins.dst = slot_of[p];
+            // Слоты операндов освобождаются после выбора слота результата, чтобы они не совпадали
+            for (size_t k = 0; k < arity(ins.op); ++k) {
+                size_t q = position[operand(ins, k)];
+                operand(ins, k) = slot_of[q];
+                bool repeated = (k > 0 && ins.a == operand(ins, k)) || (k > 1 && ins.b == operand(ins, k));
+                if (last_use[q] == p && !repeated) {
+                    free_slots.push_back(slot_of[q]);
+                }
+            }
+            scheduled.push_back(ins);
+        }
+        for (unsigned& result : results_) {
+            result = slot_of[result];
+        }
+        instructions_ = std::move(scheduled);
+    }
+
+    // Добавляет инструкцию и её операнды в порядок вычисления
+    void schedule(unsigned index, const std::vector<size_t>& need, std::vector<unsigned>& position,
+                  std::vector<unsigned>& order) const {
+        if (position[index] != instructions_.size()) {
+            return;
+        }
+        const Instruction& ins = instructions_[index];
+        std::vector<unsigned> operands;
+        for (size_t k = 0; k < arity(ins.op); ++k) {
+            operands.push_back(k == 0 ? ins.a : k == 1 ? ins.b : ins.c);
+        }
+        std::stable_sort(operands.begin(), operands.end(), [&](unsigned x, unsigned y) { return need[x] > need[y]; });
+        for (unsigned operand_index : operands) {
+            schedule(operand_index, need, position, order);
+        }
+        position[index] = static_cast<unsigned>(order.size());
+        order.push_back(index);
+    }
+
+    using Kind = typename Expression<T>::Kind;
+
+    // Построитель схемы Горнера, только подсчитывающий число операций (с теми же свёртками констант)
+    struct CostBuilder {
+        using Result = std::optional<T>; // Известное значение константы или пусто
+        size_t cost = 0;
+
+        Result constant(const T& value) { return value; }
+        Result power(const std::string&, unsigned n) {
+            cost += power_chain_length(n);
+            return std::nullopt;
+        }
+        Result fma(const Result& a, const Result& b, const Result& c) {
+            if (a && b && c) {
+                return fused_multiply_add(*a, *b, *c);
+            }
+            bool add_free = c && *c == T(0);
+            if (a && *a == T(1)) {
+                cost += add_free ? 0 : 1; // 1 * b + c — сложение
+            } else if (add_free) {
+                return mul(a, b);
+            } else {
+                ++cost;
+            }
+            return std::nullopt;
+        }
+        Result mul(const Result& a, const Result& b) {
+            if (a && b) {
+                return *a * *b;
+            }
+            if (!(a && *a == T(1)) && !(b && *b == T(1))) {
+                ++cost;
+            }
+            return std::nullopt;
+        }
+    };
+
+    // Компилятор дерева выражения в инструкции; он же построитель схемы Горнера
+    class Compiler {
+    public:
+        using Result = unsigned; // Номер слота
+
+        Compiler(CompiledExpression& target, bool use_polynomials)
+            : target_(target), use_polynomials_(use_polynomials) {}
+
+        unsigned emit(const Expression<T>& expr) {
+            auto iter = slots_.find(expr.id());
+            if (iter != slots_.end()) {
+                return iter->second; // Общее подвыражение уже вычислено
+            }
+            unsigned slot = emit_node(expr);
+            slots_.emplace(expr.id(), slot);
+            return slot;
+        }
+
+        // Операции построителя схемы Горнера
+        unsigned constant(const T& value) {
+            for (unsigned slot : constants_) {
+                if (is_constant(slot, value)) {
+                    return slot; // Одинаковые константы занимают один слот
+                }
+            }
+            constants_.push_back(push(OpCode::Const, 0, 0, 0, value));
+            return constants_.back();
+        }
+        unsigned power(const std::string& name, unsigned n) {
+            return power_slot(variable(name), n);
+        }
+        unsigned fma(unsigned a, unsigned b, unsigned c) {
+            if (is_constant(a, T(1))) {
+                return is_constant(c, T(0)) ? b : binary(OpCode::Add, b, c);
+            }
+            if (is_constant(c, T(0))) {
+                return mul(a, b);
+            }
+            return push(OpCode::Fma, a, b, c);
+        }
+        unsigned mul(unsigned a, unsigned b) {
+            if (is_constant(a, T(1))) {
+                return b;
+            }
+            if (is_constant(b, T(1))) {
+                return a;
+            }
+            return binary(OpCode::Mul, a, b);
+        }
+
+    private:
+        unsigned emit_node(const Expression<T>& expr) {
+            Kind kind = expr.kind();
+            if (use_polynomials_ && kind != Kind::Value && kind != Kind::Variable) {
+                const auto& rational = analysis_.analyze(expr);
+                if (rational && horner_cost(*rational) <= tree_cost(expr)) {
+                    return emit_rational(*rational);
+                }
+            }
+
+            switch (kind) {
+            case Kind::Value:
+                return constant(expr.value());
+            case Kind::Variable:
+                return variable(expr.name());
+            default:
+                break;
+            }
+
+            std::vector<Expression<T>> operands = expr.operands();
+            long long n;
+            if (kind == Kind::Pow && operands[1].kind() == Kind::Value && is_integer_exponent(operands[1].value(), n)) {
+                unsigned base = emit(operands[0]); // Целая степень — цепочка умножений
+                if (n == 0) {
+                    return constant(T(1));
+                }
+                unsigned magnitude = power_slot(base, n < 0 ? -n : n);
+                return n < 0 ? binary(OpCode::Div, constant(T(1)), magnitude) : magnitude;
+            }
+
+            switch (kind) {
+            case Kind::Add:
+                return binary(OpCode::Add, emit(operands[0]), emit(operands[1]));
+            case Kind::Sub:
+                return binary(OpCode::Sub, emit(operands[0]), emit(operands[1]));
+            case Kind::Mul:
+                return binary(OpCode::Mul, emit(operands[0]), emit(operands[1]));
+            case Kind::Div:
+                return binary(OpCode::Div, emit(operands[0]), emit(operands[1]));
+            case Kind::Pow:
+                return binary(OpCode::Pow, emit(operands[0]), emit(operands[1]));
+            case Kind::Sin:
+                return unary(OpCode::Sin, emit(operands[0]));
+            case Kind::Cos:
+                return unary(OpCode::Cos, emit(operands[0]));
+            case Kind::Ln:
+                return unary(OpCode::Ln, emit(operands[0]));
+            case Kind::Exp:
+                return unary(OpCode::Exp, emit(operands[0]));
+            default:
+                throw std::logic_error("Unsupported expression node");
+            }
+        }
+
+        unsigned emit_rational(const RationalFunction<T>& rational) {
+            unsigned numerator = rational.numerator().horner(*this);
+            if (rational.is_polynomial()) {
+                return numerator;
+            }
+            return binary(OpCode::Div, numerator, power_slot(rational.base().horner(*this), rational.power()));
+        }
+
+        // Число операций схемы Горнера
+        static size_t horner_cost(const RationalFunction<T>& rational) {
+            CostBuilder builder;
+            rational.numerator().horner(builder);
+            if (!rational.is_polynomial()) {
+                rational.base().horner(builder);
+                builder.cost += power_chain_length(rational.power()) + 1;
+            }
+            return builder.cost;
+        }
+
+        // Число операций при вычислении дерева (целые степени — по длине цепочки умножений)
+        size_t tree_cost(const Expression<T>& expr) {
+            auto iter = costs_.find(expr.id());
+            if (iter != costs_.end()) {
+                return iter->second;
+            }
+            size_t cost = 0;
+            std::vector<Expression<T>> operands = expr.operands();
+            long long n;
+            if (expr.kind() == Kind::Pow && operands[1].kind() == Kind::Value &&
+                is_integer_exponent(operands[1].value(), n)) {
+                cost = tree_cost(operands[0]) + power_chain_length(n < 0 ? -n : n) + (n < 0 ? 1 : 0);
+            } else if (!operands.empty()) {
+                cost = 1;
+                for (const Expression<T>& operand : operands) {
+                    cost += tree_cost(operand);
+                }
+            }
+            costs_.emplace(expr.id(), cost);
+            return cost;
+        }
+
+        unsigned variable(const std::string& name) {
+            auto iter = variables_.find(name);
+            if (iter != variables_.end()) {
+                return iter->second;
+            }
+            unsigned index = static_cast<unsigned>(target_.variables_.size());
+            target_.variables_.push_back(name);
+            unsigned slot = push(OpCode::Var, index);
+            variables_.emplace(name, slot);
+            return slot;
+        }
+
+        // Степень base^n цепочкой умножений; промежуточные степени переиспользуются
+        unsigned power_slot(unsigned base, unsigned long long n) {
+            if (n == 1) {
+                return base;
+            }
+            auto key = std::make_pair(base, n);
+            auto iter = powers_.find(key);
+            if (iter != powers_.end()) {
+                return iter->second;
+            }
+            unsigned slot;
+            if (n % 2 == 0) {
+                unsigned half = power_slot(base, n / 2);
+                slot = binary(OpCode::Mul, half, half);
+            } else {
+                slot = binary(OpCode::Mul, power_slot(base, n - 1), base);
+            }
+            powers_.emplace(key, slot);
+            return slot;
+        }
+
+        bool is_constant(unsigned slot, const T& value) const {
+            const Instruction& ins = target_.instructions_[slot];
+            return ins.op == OpCode::Const && ins.constant == value;
+        }
+
+        unsigned unary(OpCode op, unsigned a) {
+            return push(op, a);
+        }
+        unsigned binary(OpCode op, unsigned a, unsigned b) {
+            return push(op, a, b);
+        }
+        // До распределения слотов результат инструкции хранится в слоте с её номером
+        unsigned push(OpCode op, unsigned a = 0, unsigned b = 0, unsigned c = 0, const T& constant = T(0)) {
+            unsigned index = static_cast<unsigned>(target_.instructions_.size());
+            target_.instructions_.push_back({op, a, b, c, constant, index});
+            return static_cast<unsigned>(target_.instructions_.size() - 1);
+        }
+
+        CompiledExpression& target_;
+        bool use_polynomials_;
+        RationalAnalysis<T> analysis_;
+        std::map<const void*, unsigned> slots_;
+        std::map<const void*, size_t> costs_;
+        std::map<std::string, unsigned> variables_;
+        std::vector<unsigned> constants_;
+        std::map<std::pair<unsigned, unsigned long long>, unsigned> powers_;
+    };
+
+    std::vector<std::string> variables_;
+    std::vector<Instruction> instructions_;
+    std::vector<unsigned> results_; // Слоты выходов
+    size_t slot_count_ = 0;         // Число слотов рабочей памяти
+};
+
+#endif // COMPILED_HPP
@@ -0,0 +1,553 @@
+#ifndef EGRAPH_HPP
+#define EGRAPH_HPP
+
+#include "expression.hpp"
+#include "polynomial.hpp"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <map>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Стоимость операций для выбора самого дешёвого эквивалентного выражения
+struct OperationCosts {
+    double value = 0;
+    double variable = 0;
+    double add = 1;
+    double sub = 1;
+    double mul = 1;
+    double div = 4;
+    double pow = 8;      // Степень с непостоянным или нецелым показателем; целые — по длине цепочки умножений
+    double sin = 10;
+    double cos = 10;
+    double ln = 10;
+    double exp = 10;
+};
+
+// Ограничения насыщения, чтобы оптимизацию можно было безопасно запускать при загрузке формул
+struct EGraphBudget {
+    size_t max_nodes = 10000;                          // Предельное число узлов e-графа
+    size_t max_iterations = 8;                         // Предельное число раундов применения правил
+    std::chrono::milliseconds time_limit{50};          // Предельное время насыщения
+};
+
+// E-граф над выражениями: классы эквивалентных узлов с хешированием узлов (hashcons) и
+// системой непересекающихся множеств. Правила переписывания добавляют эквивалентные формы,
+// не удаляя исходные, а извлечение выбирает в каждом классе узел минимальной стоимости.
+// Классы, все узлы которых вычисляются из констант, сворачиваются в константу
+template<typename T>
+class EGraph {
+public:
+    using Kind = typename Expression<T>::Kind;
+    using ClassId = size_t;
+
+    // Узел: операция над классами-операндами, число или переменная
+    struct Node {
+        Kind kind;
+        std::vector<ClassId> children;
+        T value{};
+        std::string name;
+
+        bool operator==(const Node& that) const {
+            return kind == that.kind && children == that.children && value == that.value && name == that.name;
+        }
+    };
+
+    // Правило переписывания: получает класс и один из его узлов, добавляет эквивалентные узлы через merge
+    struct Rule {
+        std::string name;
+        std::function<void(EGraph&, ClassId, const Node&)> apply;
+    };
+
+    // Добавление дерева выражения; общие подвыражения попадают в один класс
+    ClassId add(const Expression<T>& expr) {
+        std::map<const void*, ClassId> memo;
+        return add_expression(expr, memo);
+    }
+
+    // Добавление узла с заданными операндами
+    ClassId add(Kind kind, std::vector<ClassId> children) {
+        Node node{kind, std::move(children), T{}, std::string()};
+        return add(std::move(node));
+    }
+    ClassId constant(const T& value) {
+        return add(Node{Kind::Value, {}, value, std::string()});
+    }
+
+    ClassId find(ClassId id) const {
+        while (parent_[id] != id) {
+            id = parent_[id];
+        }
+        return id;
+    }
+
+    // Объединяет два класса; true, если они были разными
+    bool merge(ClassId a, ClassId b) {
+        a = find(a);
+        b = find(b);
+        if (a == b) {
+            return false;
+        }
+        if (classes_[a].nodes.size() < classes_[b].nodes.size()) {
+            std::swap(a, b);
+        }
+        parent_[b] = a;
+        auto& nodes = classes_[a].nodes;
+        nodes.insert(nodes.end(), classes_[b].nodes.begin(), classes_[b].nodes.end());
+        classes_[b].nodes.clear();
+        if (!classes_[a].constant) {
+            classes_[a].constant = classes_[b].constant;
+        }
+        ++merges_;
+        return true;
+    }
+
+    // Узлы класса (копия: правила могут менять граф, пока её обходят)
+    std::vector<Node> nodes(ClassId id) const {
+        return classes_[find(id)].nodes;
+    }
+
+    // Значение класса, если он равен константе
+    std::optional<T> constant_value(ClassId id) const {
+        return classes_[find(id)].constant;
+    }
+    bool is_constant(ClassId id, const T& value) const {
+        auto constant = constant_value(id);
+        return constant && *constant == value;
+    }
+
+    // Класс заведомо положителен: положительная вещественная константа или экспонента
+    bool is_positive(ClassId id) const {
+        if constexpr (std::is_floating_point_v<T>) {
+            auto constant = constant_value(id);
+            if (constant && *constant > T(0)) {
+                return true;
+            }
+            for (const Node& node : classes_[find(id)].nodes) {
+                if (node.kind == Kind::Exp) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    size_t node_count() const { return hashcons_.size(); }
+    size_t class_count() const {
+        size_t count = 0;
+        for (ClassId id = 0; id < parent_.size(); ++id) {
+            count += parent_[id] == id;
+        }
+        return count;
+    }
+
+    // Восстанавливает конгруэнтность: узлы с одинаковыми операндами после объединений попадают в один класс
+    void rebuild() {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            hashcons_.clear();
+            for (ClassId id = 0; id < classes_.size(); ++id) {
+                if (parent_[id] != id) {
+                    continue;
+                }
+                std::vector<Node> canonical;
+                std::unordered_set<Node, NodeHash> seen;
+                for (Node node : classes_[id].nodes) {
+                    canonicalize(node);
+                    if (seen.insert(node).second) {
+                        canonical.push_back(node);
+                    }
+                }
+                classes_[id].nodes = canonical;
+            }
+            // Конгруэнтные пары сначала собираются: merge меняет списки узлов, которые здесь обходятся
+            std::vector<std::pair<ClassId, ClassId>> congruent;
+            for (ClassId id = 0; id < classes_.size(); ++id) {
+                if (parent_[id] != id) {
+                    continue;
+                }
+                for (const Node& node : classes_[id].nodes) {
+                    auto [iter, inserted] = hashcons_.emplace(node, id);
+                    if (!inserted && iter->second != id) {
+                        congruent.emplace_back(iter->second, id);
+                    }
+                }
+            }
+            for (const auto& [a, b] : congruent) {
+                changed |= merge(a, b);
+            }
+        }
+    }
+
+    // Насыщение правилами в пределах бюджета; возвращает число выполненных раундов
+    size_t saturate(const std::vector<Rule>& rules, const EGraphBudget& budget) {
+        auto deadline = std::chrono::steady_clock::now() + budget.time_limit;
+        size_t iteration = 0;
+        bool exhausted = false;
+        while (iteration < budget.max_iterations && !exhausted) {
+            ++iteration;
+            std::vector<std::pair<ClassId, Node>> matches;
+            for (ClassId id = 0; id < classes_.size(); ++id) {
+                if (parent_[id] == id) {
+                    for (const Node& node : classes_[id].nodes) {
+                        matches.emplace_back(id, node);
+                    }
+                }
+            }
+            size_t nodes_before = node_count();
+            size_t merges_before = merges_;
+            for (const auto& [id, node] : matches) {
+                for (const Rule& rule : rules) {
+                    rule.apply(*this, find(id), node);
+                }
+                if (node_count() > budget.max_nodes || std::chrono::steady_clock::now() > deadline) {
+                    exhausted = true;
+                    break;
+                }
+            }
+            rebuild();
+            if (node_count() == nodes_before && merges_ == merges_before) {
+                break; // Насыщение: правила больше ничего не добавляют
+            }
+        }
+        return iteration;
+    }
+
+    // Выражение минимальной стоимости для класса; общие подвыражения извлекаются как общие узлы
+    Expression<T> extract(ClassId root, const OperationCosts& costs = OperationCosts()) const {
+        const double infinity = std::numeric_limits<double>::infinity();
+        std::vector<double> best(classes_.size(), infinity);
+        std::vector<const Node*> choice(classes_.size(), nullptr);
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (ClassId id = 0; id < classes_.size(); ++id) {
+                if (parent_[id] != id) {
+                    continue;
+                }
+                for (const Node& node : classes_[id].nodes) {
+                    double cost = node_cost(node, costs);
+                    for (ClassId child : node.children) {
+                        cost += best[find(child)];
+                    }
+                    if (cost < best[id]) {
+                        best[id] = cost;
+                        choice[id] = &node;
+                        changed = true;
+                    }
+                }
+            }
+        }
+        std::map<ClassId, Expression<T>> memo;
+        return build(find(root), choice, memo);
+    }
+
+    // Набор правил по умолчанию: алгебраические тождества, сокращение exp/ln, общие обратные величины
+    static std::vector<Rule> default_rules() {
+        std::vector<Rule> rules;
+        rules.push_back({"commute", [](EGraph& g, ClassId id, const Node& n) {
+            if (n.kind == Kind::Add || n.kind == Kind::Mul) {
+                g.merge(id, g.add(n.kind, {n.children[1], n.children[0]}));
+            }
+        }});
+        rules.push_back({"associate", [](EGraph& g, ClassId id, const Node& n) {
+            if (n.kind != Kind::Add && n.kind != Kind::Mul) {
+                return;
+            }
+            for (const Node& left : g.nodes(n.children[0])) {
+                if (left.kind == n.kind) {
+                    g.merge(id, g.add(n.kind, {left.children[0], g.add(n.kind, {left.children[1], n.children[1]})}));
+                }
+            }
+        }});
+        rules.push_back({"identity", [](EGraph& g, ClassId id, const Node& n) {
+            if (n.children.size() != 2) {
+                return;
+            }
+            ClassId a = n.children[0], b = n.children[1];
+            switch (n.kind) {
+            case Kind::Add:
+            case Kind::Sub:
+                if (g.is_constant(b, T(0))) g.merge(id, a);
+                break;
+            case Kind::Mul:
+                if (g.is_constant(b, T(1))) g.merge(id, a);
+                if (g.is_constant(b, T(0))) g.merge(id, g.constant(T(0)));
+                break;
+            case Kind::Div:
+                if (g.is_constant(b, T(1))) g.merge(id, a);
+                break;
+            case Kind::Pow:
+                if (g.is_constant(b, T(1))) g.merge(id, a);
+                if (g.is_constant(b, T(0))) g.merge(id, g.constant(T(1)));
+                break;
+            default:
+                break;
+            }
+        }});
+        rules.push_back({"cancel", [](EGraph& g, ClassId id, const Node& n) {
+            if (n.kind == Kind::Sub && g.find(n.children[0]) == g.find(n.children[1])) {
+                g.merge(id, g.constant(T(0)));
+            }
+            if (n.kind == Kind::Div && g.find(n.children[0]) == g.find(n.children[1])) {
+                g.merge(id, g.constant(T(1)));
+            }
+        }});
+        rules.push_back({"reciprocal", [](EGraph& g, ClassId id, const Node& n) {
+            // a * (1 / b) = a / b и обратно: деление через общую обратную величину 1 / b
+            if (n.kind == Kind::Mul) {
+                for (const Node& right : g.nodes(n.children[1])) {
+                    if (right.kind == Kind::Div && g.is_constant(right.children[0], T(1))) {
+                        g.merge(id, g.add(Kind::Div, {n.children[0], right.children[1]}));
+                    }
+                }
+            }
+            if (n.kind == Kind::Div && !g.is_constant(n.children[0], T(1))) {
+                g.merge(id, g.add(Kind::Mul, {n.children[0], g.add(Kind::Div, {g.constant(T(1)), n.children[1]})}));
+            }
+        }});
+        rules.push_back({"exp-ln", [](EGraph& g, ClassId id, const Node& n) {
+            if (n.kind != Kind::Ln && n.kind != Kind::Exp) {
+                return;
+            }
+            for (const Node& arg : g.nodes(n.children[0])) {
+                if ((n.kind == Kind::Ln && arg.kind == Kind::Exp) || (n.kind == Kind::Exp && arg.kind == Kind::Ln)) {
+                    g.merge(id, arg.children[0]);
+                }
+                // ln(a ^ b) = b * ln(a) только для заведомо положительного a: иначе ln(x ^ 4) при x < 0 стал бы NaN
+                if (n.kind == Kind::Ln && arg.kind == Kind::Pow && g.is_positive(arg.children[0])) {
+                    g.merge(id, g.add(Kind::Mul, {arg.children[1], g.add(Kind::Ln, {arg.children[0]})}));
+                }
+            }
+        }});
+        rules.push_back({"factor", [](EGraph& g, ClassId id, const Node& n) {
+            // a * b + a * c = a * (b + c)
+            if (n.kind != Kind::Add && n.kind != Kind::Sub) {
+                return;
+            }
+            std::vector<Node> lefts = g.nodes(n.children[0]), rights = g.nodes(n.children[1]);
+            for (const Node& left : lefts) {
+                if (left.kind != Kind::Mul) {
+                    continue;
+                }
+                for (const Node& right : rights) {
+                    if (right.kind == Kind::Mul && g.find(left.children[0]) == g.find(right.children[0])) {
+                        g.merge(id, g.add(Kind::Mul, {left.children[0], g.add(n.kind, {left.children[1], right.children[1]})}));
+                    }
+                }
+            }
+        }});
+        rules.push_back({"power", [](EGraph& g, ClassId id, const Node& n) {
+            // a * a = a ^ 2, a ^ k * a = a ^ (k + 1), a + a = 2 * a
+            if (n.kind == Kind::Add && g.find(n.children[0]) == g.find(n.children[1])) {
+                g.merge(id, g.add(Kind::Mul, {g.constant(T(2)), n.children[0]}));
+            }
+            if (n.kind != Kind::Mul) {
+                return;
+            }
+            if (g.find(n.children[0]) == g.find(n.children[1])) {
+                g.merge(id, g.add(Kind::Pow, {n.children[0], g.constant(T(2))}));
+            }
+            for (const Node& left : g.nodes(n.children[0])) {
+                auto exponent = left.kind == Kind::Pow ? g.constant_value(left.children[1]) : std::nullopt;
+                long long k;
+                if (exponent && g.find(left.children[0]) == g.find(n.children[1]) && is_integer_exponent(*exponent, k) &&
+                    k + 1 <= kMaxIntegerExponent) {
+                    g.merge(id, g.add(Kind::Pow, {n.children[1], g.constant(*exponent + T(1))}));
+                }
+            }
+        }});
+        return rules;
+    }
+
+private:
+    struct NodeHash {
+        size_t operator()(const Node& node) const {
+            size_t seed = static_cast<size_t>(node.kind);
+            auto combine = [&seed](size_t value) { seed ^= value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2); };
+            for (ClassId child : node.children) {
+                combine(child);
+            }
+            if constexpr (is_complex<T>::value) {
+                combine(std::hash<typename T::value_type>()(node.value.real()));
+                combine(std::hash<typename T::value_type>()(node.value.imag()));
+            } else {
+                combine(std::hash<T>()(node.value));
+            }
+            combine(std::hash<std::string>()(node.name));
+            return seed;
+        }
+    };
+
+    struct EClass {
+        std::vector<Node> nodes;
+        std::optional<T> constant; // Значение, если класс равен константе
+    };
+
+    void canonicalize(Node& node) const {
+        for (ClassId& child : node.children) {
+            child = find(child);
+        }
+    }
+
+    ClassId add(Node node) {
+        canonicalize(node);
+        auto iter = hashcons_.find(node);
+        if (iter != hashcons_.end()) {
+            return find(iter->second);
+        }
+        ClassId id = classes_.size();
+        parent_.push_back(id);
+        classes_.push_back(EClass{{node}, fold(node)});
+        hashcons_.emplace(node, id);
+        if (classes_[id].constant && node.kind != Kind::Value) {
+            merge(id, constant(*classes_[id].constant)); // Свёртка констант
+        }
+        return find(id);
+    }
+
+    // Значение узла, все операнды которого — константы. Не сворачиваются результаты,
+    // при вычислении которых дерево бросило бы исключение или получило бы не число
+    std::optional<T> fold(const Node& node) const {
+        if (node.kind == Kind::Value) {
+            return node.value;
+        }
+        if (node.kind == Kind::Variable) {
+            return std::nullopt;
+        }
+        std::vector<T> args;
+        for (ClassId child : node.children) {
+            auto value = classes_[find(child)].constant;
+            if (!value) {
+                return std::nullopt;
+            }
+            args.push_back(*value);
+        }
+        T result;
+        switch (node.kind) {
+        case Kind::Add: result = args[0] + args[1]; break;
+        case Kind::Sub: result = args[0] - args[1]; break;
+        case Kind::Mul: result = args[0] * args[1]; break;
+        case Kind::Div:
+            if (args[1] == T(0)) {
+                return std::nullopt;
+            }
+            result = args[0] / args[1];
+            break;
+        case Kind::Pow: result = fast_pow(args[0], args[1]); break;
+        case Kind::Sin: result = std::sin(args[0]); break;
+        case Kind::Cos: result = std::cos(args[0]); break;
+        case Kind::Ln: result = std::log(args[0]); break;
+        case Kind::Exp: result = std::exp(args[0]); break;
+        default: return std::nullopt;
+        }
+        if constexpr (std::is_floating_point_v<T>) {
+            if (!std::isfinite(result)) {
+                return std::nullopt;
+            }
+        }
+        return result;
+    }
+
+    ClassId add_expression(const Expression<T>& expr, std::map<const void*, ClassId>& memo) {
+        auto iter = memo.find(expr.id());
+        if (iter != memo.end()) {
+            return iter->second;
+        }
+        ClassId id;
+        switch (expr.kind()) {
+        case Kind::Value:
+            id = constant(expr.value());
+            break;
+        case Kind::Variable:
+            id = add(Node{Kind::Variable, {}, T{}, expr.name()});
+            break;
+        default: {
+            std::vector<ClassId> children;
+            for (const Expression<T>& operand : expr.operands()) {
+                children.push_back(add_expression(operand, memo));
+            }
+            id = add(expr.kind(), std::move(children));
+            break;
+        }
+        }
+        memo.emplace(expr.id(), id);
+        return id;
+    }
+
+    double node_cost(const Node& node, const OperationCosts& costs) const {
+        switch (node.kind) {
+        case Kind::Value: return costs.value;
+        case Kind::Variable: return costs.variable;
+        case Kind::Add: return costs.add;
+        case Kind::Sub: return costs.sub;
+        case Kind::Mul: return costs.mul;
+        case Kind::Div: return costs.div;
+        case Kind::Pow: {
+            auto exponent = constant_value(node.children[1]);
+            long long n;
+            if (exponent && is_integer_exponent(*exponent, n)) {
+                return costs.mul * power_chain_length(n < 0 ? -n : n) + (n < 0 ? costs.div : 0);
+            }
+            return costs.pow;
+        }
+        case Kind::Sin: return costs.sin;
+        case Kind::Cos: return costs.cos;
+        case Kind::Ln: return costs.ln;
+        case Kind::Exp: return costs.exp;
+        }
+        return costs.pow;
+    }
+
+    Expression<T> build(ClassId id, const std::vector<const Node*>& choice, std::map<ClassId, Expression<T>>& memo) const {
+        auto iter = memo.find(id);
+        if (iter != memo.end()) {
+            return iter->second;
+        }
+        const Node& node = *choice[id];
+        std::vector<Expression<T>> args;
+        for (ClassId child : node.children) {
+            args.push_back(build(find(child), choice, memo));
+        }
+        std::optional<Expression<T>> result;
+        switch (node.kind) {
+        case Kind::Value: result = Expression<T>(node.value); break;
+        case Kind::Variable: result = Expression<T>(node.name); break;
+        case Kind::Add: result = args[0] + args[1]; break;
+        case Kind::Sub: result = args[0] - args[1]; break;
+        case Kind::Mul: result = args[0] * args[1]; break;
+        case Kind::Div: result = args[0] / args[1]; break;
+        case Kind::Pow: result = args[0] ^ args[1]; break;
+        case Kind::Sin: result = args[0].sin(); break;
+        case Kind::Cos: result = args[0].cos(); break;
+        case Kind::Ln: result = args[0].ln(); break;
+        case Kind::Exp: result = args[0].exp(); break;
+        }
+        memo.emplace(id, *result);
+        return *result;
+    }
+
+    std::vector<ClassId> parent_;
+    std::vector<EClass> classes_;
+    std::unordered_map<Node, ClassId, NodeHash> hashcons_;
+    size_t merges_ = 0;
+};
+
+// Оптимизация выражения насыщением e-графа и извлечением самой дешёвой формы по модели стоимости.
+// Выражение рассматривается как функция там, где оно определено: например, x / x заменяется на 1
+template<typename T>
+Expression<T> optimize(const Expression<T>& expr, const EGraphBudget& budget = EGraphBudget(),
+                       const OperationCosts& costs = OperationCosts()) {
+    EGraph<T> graph;
+    typename EGraph<T>::ClassId root = graph.add(expr);
+    graph.saturate(EGraph<T>::default_rules(), budget);
+    return graph.extract(root, costs);
+}
+
+#endif // EGRAPH_HPP
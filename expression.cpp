@@ -1,5 +1,38 @@
 #include "expression.hpp"
 #include "parser.hpp"
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+// Общая нумерация имён переменных. Каждый поток держит свою копию уже встреченных имён,
+// поэтому общий реестр блокируется только при первой встрече имени в потоке
+unsigned variable_index(const std::string& name, bool register_name) {
+    static std::shared_mutex mutex;
+    static std::unordered_map<std::string, unsigned> registry;
+    thread_local std::unordered_map<std::string, unsigned> cache;
+
+    auto cached = cache.find(name);
+    if (cached != cache.end()) {
+        return cached->second;
+    }
+    unsigned index = kNoVariable;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        auto iter = registry.find(name);
+        if (iter != registry.end()) {
+            index = iter->second;
+        }
+    }
+    if (index == kNoVariable) {
+        if (!register_name) {
+            return kNoVariable; // Не запоминается: имя может появиться позже
+        }
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        index = registry.emplace(name, static_cast<unsigned>(registry.size())).first->second;
+    }
+    cache.emplace(name, index);
+    return index;
+}
 
 // Реализация метода from_string
 template<>
@@ -8,6 +41,12 @@ Expression<double> Expression<double>::from_string(const std::string& input) {
     return parser.parse();
 }
 
+template<>
+Expression<float> Expression<float>::from_string(const std::string& input) {
+    BasicParser<float> parser(input);
+    return parser.parse();
+}
+
 // Определения пользовательских литералов
 Expression<double> operator"" _val(long double val) {
     return Expression<double>(static_cast<double>(val));
@@ -18,6 +57,15 @@ Expression<double> operator"" _var(const char* variable, size_t size) {
     return Expression<double>(std::string(variable));
 }
 
+Expression<float> operator"" _val_f(long double val) {
+    return Expression<float>(static_cast<float>(val));
+}
+
+Expression<float> operator"" _var_f(const char* variable, size_t size) {
+    (void)size;
+    return Expression<float>(std::string(variable));
+}
+
 Expression<std::complex<double>> operator"" _val_c(long double val) {
     return Expression<std::complex<double>>(static_cast<std::complex<double>>(val));
 }
@@ -1,6 +1,8 @@
 #ifndef EXPRESSION_HPP
 #define EXPRESSION_HPP
 
+#include <algorithm>
+#include <iterator>
 #include <string>
 #include <map>
 #include <memory>
@@ -9,9 +11,107 @@
 #include <cmath>
 #include <sstream>
 #include <type_traits>
+#include <vector>
 
-// Предварительное объявление класса Parser
-class Parser;
+// Признак комплексного типа
+template<typename T>
+struct is_complex : std::false_type {};
+template<typename T>
+struct is_complex<std::complex<T>> : std::true_type {};
+
+// Максимальный модуль целого показателя, который возводится в степень цепочкой умножений
+constexpr long long kMaxIntegerExponent = 64;
+
+// Проверяет, что показатель степени — небольшое целое число, и возвращает его в n
+template<typename T>
+bool is_integer_exponent(const T& exponent, long long& n) {
+    if constexpr (std::is_floating_point_v<T>) {
+        if (!(std::abs(exponent) <= static_cast<T>(kMaxIntegerExponent)) || exponent != std::trunc(exponent)) {
+            return false;
+        }
+        n = static_cast<long long>(exponent);
+        return true;
+    } else if constexpr (is_complex<T>::value) {
+        return exponent.imag() == 0 && is_integer_exponent(exponent.real(), n); // Только вещественные целые показатели
+    } else {
+        return false;
+    }
+}
+
+// Возведение в целую степень цепочкой умножений (бинарное возведение) вместо std::pow
+template<typename T>
+T integer_power(T base, long long n) {
+    if (n < 0) {
+        return T(1) / integer_power(base, -n); // Отрицательная степень — обратная величина
+    }
+    T result(1);
+    while (n > 0) {
+        if (n & 1) {
+            result *= base;
+        }
+        n >>= 1;
+        if (n > 0) {
+            base *= base;
+        }
+    }
+    return result;
+}
+
+// Возведение в степень: целые показатели — умножениями, остальные — через std::pow
+template<typename T>
+T fast_pow(const T& base, const T& exponent) {
+    long long n;
+    if (is_integer_exponent(exponent, n)) {
+        return integer_power(base, n);
+    }
+    return std::pow(base, exponent);
+}
+
+// Номер переменной в общей нумерации имён. Без регистрации незнакомое имя даёт kNoVariable:
+// ни один узел от такой переменной не зависит
+constexpr unsigned kNoVariable = ~0u;
+unsigned variable_index(const std::string& name, bool register_name = true);
+
+// Множество переменных, от которых зависит узел выражения: отсортированные номера переменных.
+// Размер не ограничен; узлы с одинаковым множеством (например, операнд и его функция) разделяют одну копию
+class VariableSet {
+public:
+    VariableSet() = default;
+    explicit VariableSet(unsigned index) : indices_(std::make_shared<const std::vector<unsigned>>(1, index)) {}
+
+    bool empty() const { return !indices_; }
+    size_t size() const { return indices_ ? indices_->size() : 0; }
+    bool contains(unsigned index) const {
+        return indices_ && std::binary_search(indices_->begin(), indices_->end(), index);
+    }
+
+    // Объединение; если одно множество содержит другое, новая копия не создаётся
+    VariableSet operator|(const VariableSet& that) const {
+        if (that.empty() || indices_ == that.indices_) {
+            return *this;
+        }
+        if (empty()) {
+            return that;
+        }
+        const std::vector<unsigned>& a = *indices_;
+        const std::vector<unsigned>& b = *that.indices_;
+        if (std::includes(a.begin(), a.end(), b.begin(), b.end())) {
+            return *this;
+        }
+        if (std::includes(b.begin(), b.end(), a.begin(), a.end())) {
+            return that;
+        }
+        auto merged = std::make_shared<std::vector<unsigned>>();
+        merged->reserve(a.size() + b.size());
+        std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(*merged));
+        VariableSet result;
+        result.indices_ = std::move(merged);
+        return result;
+    }
+
+private:
+    std::shared_ptr<const std::vector<unsigned>> indices_; // Пусто — выражение без переменных
+};
 
 // Шаблонный класс Expression, представляющий арифметическое выражение
 template<typename T>
@@ -35,8 +135,11 @@ public:
         return *this;
     }
 
+    // Вид узла выражения (используется анализирующими проходами, например компиляцией)
+    enum class Kind { Value, Variable, Add, Sub, Mul, Div, Pow, Sin, Cos, Ln, Exp };
+
     // Метод для создания выражения из строки
-    static Expression<double> from_string(const std::string& input);
+    static Expression from_string(const std::string& input);
 
     // Арифметические операции
     Expression operator+(const Expression& that) const {
@@ -101,7 +204,15 @@ public:
 
     // Символьное дифференцирование
     Expression diff(const std::string& variable) const {
-        return impl_->diff(variable); // Вызов diff у внутренней реализации
+        return diff(variable, variable_index(variable, false));
+    }
+
+    // Переменные, от которых зависит выражение (вычисляются при построении узлов)
+    const VariableSet& dependencies() const {
+        return impl_->dependencies();
+    }
+    bool depends_on(const std::string& variable) const {
+        return dependencies().contains(variable_index(variable, false));
     }
 
     // Упрощение выражения
@@ -109,15 +220,51 @@ public:
         return impl_->simplify(); // Вызов simplify у внутренней реализации
     }
 
+    // Структура выражения для анализирующих проходов
+    Kind kind() const {
+        return impl_->kind(); // Вид корневого узла
+    }
+    std::vector<Expression> operands() const {
+        return impl_->operands(); // Операнды корневого узла (пусто для чисел и переменных)
+    }
+    T value() const {
+        return impl_->value(); // Значение числа (только для Kind::Value)
+    }
+    std::string name() const {
+        return impl_->name(); // Имя переменной (только для Kind::Variable)
+    }
+    const void* id() const {
+        return impl_.get(); // Идентификатор узла: общие подвыражения имеют одинаковый id
+    }
+
 private:
+    // Производная по переменной с номером index: поддеревья, не зависящие от неё, дают ноль без обхода
+    Expression diff(const std::string& variable, unsigned index) const {
+        if (!depends_on(index)) {
+            return Expression(0.0);
+        }
+        return impl_->diff(variable, index);
+    }
+    bool depends_on(unsigned index) const {
+        return impl_->dependencies().contains(index);
+    }
+
     // Базовый класс для всех типов выражений (число, переменная, операции)
     class ExpressionImpl {
     public:
+        explicit ExpressionImpl(VariableSet dependencies = VariableSet()) : dependencies_(std::move(dependencies)) {}
         virtual ~ExpressionImpl() = default;
         virtual T eval(std::map<std::string, T> context) const = 0; // Вычисление выражения
         virtual std::string to_string() const = 0; // Преобразование в строку
-        virtual Expression diff(const std::string& variable) const = 0; // Символьное дифференцирование
+        virtual Expression diff(const std::string& variable, unsigned index) const = 0; // Символьное дифференцирование
         virtual Expression simplify() const = 0; // Упрощение выражения
+        virtual Kind kind() const = 0; // Вид узла
+        virtual std::vector<Expression> operands() const { return {}; } // Операнды узла
+        virtual T value() const { throw std::logic_error("Expression node is not a value"); }
+        virtual std::string name() const { throw std::logic_error("Expression node is not a variable"); }
+        const VariableSet& dependencies() const { return dependencies_; } // Переменные поддерева
+    private:
+        VariableSet dependencies_;
     };
 
     // Класс, представляющий число
@@ -137,12 +284,14 @@ private:
             }
             return oss.str();
         }
-        Expression diff(const std::string& variable) const override {
+        Expression diff(const std::string&, unsigned) const override {
             return Expression(0.0); // Производная числа равна нулю
         }
         Expression simplify() const override {
             return Expression(value_); // Число уже упрощено
         }
+        Kind kind() const override { return Kind::Value; }
+        T value() const override { return value_; }
     private:
         T value_; // Значение числа
     };
@@ -150,7 +299,7 @@ private:
     // Класс, представляющий переменную
     class Variable : public ExpressionImpl {
     public:
-        Variable(std::string name) : name_(name) {} // Конструктор для переменной
+        Variable(std::string name) : ExpressionImpl(VariableSet(variable_index(name))), name_(name) {} // Конструктор для переменной
         T eval(std::map<std::string, T> context) const override {
             auto iter = context.find(name_); // Ищем переменную в контексте
             if (iter == context.end()) {
@@ -161,7 +310,7 @@ private:
         std::string to_string() const override {
             return name_; // Возвращаем имя переменной
         }
-        Expression diff(const std::string& variable) const override {
+        Expression diff(const std::string& variable, unsigned) const override {
             if (name_ == variable) {
                 return Expression(1.0); // Производная по самой переменной равна 1
             } else {
@@ -171,6 +320,8 @@ private:
         Expression simplify() const override {
             return Expression(name_); // Переменная уже упрощена
         }
+        Kind kind() const override { return Kind::Variable; }
+        std::string name() const override { return name_; }
     private:
         std::string name_; // Имя переменной
     };
@@ -178,15 +329,23 @@ private:
     // Класс, представляющий операцию сложения
     class OperationAdd : public ExpressionImpl {
     public:
-        OperationAdd(Expression left, Expression right) : left_(left), right_(right) {} // Конструктор для сложения
+        OperationAdd(Expression left, Expression right)
+            : ExpressionImpl(left.dependencies() | right.dependencies()), left_(left), right_(right) {} // Конструктор для сложения
         T eval(std::map<std::string, T> context) const override {
             return left_.eval(context) + right_.eval(context); // Складываем результаты левого и правого выражений
         }
         std::string to_string() const override {
             return "(" + left_.to_string() + " + " + right_.to_string() + ")"; // Возвращаем строку вида "(a + b)"
         }
-        Expression diff(const std::string& variable) const override {
-            return left_.diff(variable) + right_.diff(variable); // Производная суммы
+        Expression diff(const std::string& variable, unsigned index) const override {
+            // Слагаемое, не зависящее от переменной, в производную не входит
+            if (!left_.depends_on(index)) {
+                return right_.diff(variable, index);
+            }
+            if (!right_.depends_on(index)) {
+                return left_.diff(variable, index);
+            }
+            return left_.diff(variable, index) + right_.diff(variable, index); // Производная суммы
         }
         Expression simplify() const override {
             Expression left = left_.simplify();
@@ -203,6 +362,8 @@ private:
             // Иначе возвращаем упрощённое сложение
             return left + right;
         }
+        Kind kind() const override { return Kind::Add; }
+        std::vector<Expression> operands() const override { return {left_, right_}; }
     private:
         Expression left_, right_; // Левый и правый операнды
     };
@@ -210,15 +371,23 @@ private:
     // Класс, представляющий операцию умножения
     class OperationMul : public ExpressionImpl {
     public:
-        OperationMul(Expression left, Expression right) : left_(left), right_(right) {} // Конструктор для умножения
+        OperationMul(Expression left, Expression right)
+            : ExpressionImpl(left.dependencies() | right.dependencies()), left_(left), right_(right) {} // Конструктор для умножения
         T eval(std::map<std::string, T> context) const override {
             return left_.eval(context) * right_.eval(context); // Умножаем результаты левого и правого выражений
         }
         std::string to_string() const override {
             return "(" + left_.to_string() + " * " + right_.to_string() + ")"; // Возвращаем строку вида "(a * b)"
         }
-        Expression diff([[maybe_unused]] const std::string& variable) const override {
-            return left_.diff(variable) * right_ + left_ * right_.diff(variable); // Правило произведения
+        Expression diff(const std::string& variable, unsigned index) const override {
+            // Постоянный множитель выносится: остаётся одна половина правила произведения
+            if (!left_.depends_on(index)) {
+                return left_ * right_.diff(variable, index);
+            }
+            if (!right_.depends_on(index)) {
+                return left_.diff(variable, index) * right_;
+            }
+            return left_.diff(variable, index) * right_ + left_ * right_.diff(variable, index); // Правило произведения
         }
         Expression simplify() const override {
             Expression left = left_.simplify();
@@ -240,6 +409,8 @@ private:
             // Иначе возвращаем упрощённое умножение
             return left * right;
         }
+        Kind kind() const override { return Kind::Mul; }
+        std::vector<Expression> operands() const override { return {left_, right_}; }
     private:
         Expression left_, right_; // Левый и правый операнды
     };
@@ -247,15 +418,22 @@ private:
     // Класс, представляющий операцию вычитания
     class OperationSub : public ExpressionImpl {
     public:
-        OperationSub(Expression left, Expression right) : left_(left), right_(right) {} // Конструктор для вычитания
+        OperationSub(Expression left, Expression right)
+            : ExpressionImpl(left.dependencies() | right.dependencies()), left_(left), right_(right) {} // Конструктор для вычитания
         T eval(std::map<std::string, T> context) const override {
             return left_.eval(context) - right_.eval(context); // Вычитаем результаты левого и правого выражений
         }
         std::string to_string() const override {
             return "(" + left_.to_string() + " - " + right_.to_string() + ")"; // Возвращаем строку вида "(a - b)"
         }
-        Expression diff(const std::string& variable) const override {
-            return left_.diff(variable) - right_.diff(variable); // Производная разности
+        Expression diff(const std::string& variable, unsigned index) const override {
+            if (!left_.depends_on(index)) {
+                return Expression(-1.0) * right_.diff(variable, index);
+            }
+            if (!right_.depends_on(index)) {
+                return left_.diff(variable, index);
+            }
+            return left_.diff(variable, index) - right_.diff(variable, index); // Производная разности
         }
         Expression simplify() const override {
             Expression left = left_.simplify();
@@ -269,6 +447,8 @@ private:
             // Иначе возвращаем упрощённое вычитание
             return left - right;
         }
+        Kind kind() const override { return Kind::Sub; }
+        std::vector<Expression> operands() const override { return {left_, right_}; }
     private:
         Expression left_, right_; // Левый и правый операнды
     };
@@ -276,7 +456,8 @@ private:
     // Класс, представляющий операцию деления
     class OperationDiv : public ExpressionImpl {
     public:
-        OperationDiv(Expression left, Expression right) : left_(left), right_(right) {} // Конструктор для деления
+        OperationDiv(Expression left, Expression right)
+            : ExpressionImpl(left.dependencies() | right.dependencies()), left_(left), right_(right) {} // Конструктор для деления
         T eval(std::map<std::string, T> context) const override {
             T denominator = right_.eval(context); // Вычисляем знаменатель
             if (denominator == T(0)) {
@@ -287,8 +468,15 @@ private:
         std::string to_string() const override {
             return "(" + left_.to_string() + " / " + right_.to_string() + ")"; // Возвращаем строку вида "(a / b)"
         }
-        Expression diff(const std::string& variable) const override {
-            return (left_.diff(variable) * right_ - left_ * right_.diff(variable)) / (right_ * right_); // Производная частного
+        Expression diff(const std::string& variable, unsigned index) const override {
+            // Постоянный знаменатель: f' / g; постоянный числитель: -f * g' / g^2
+            if (!right_.depends_on(index)) {
+                return left_.diff(variable, index) / right_;
+            }
+            if (!left_.depends_on(index)) {
+                return Expression(-1.0) * left_ * right_.diff(variable, index) / (right_ * right_);
+            }
+            return (left_.diff(variable, index) * right_ - left_ * right_.diff(variable, index)) / (right_ * right_); // Производная частного
         }
         Expression simplify() const override {
             Expression left = left_.simplify();
@@ -307,6 +495,8 @@ private:
             // Иначе возвращаем упрощённое деление
             return left / right;
         }
+        Kind kind() const override { return Kind::Div; }
+        std::vector<Expression> operands() const override { return {left_, right_}; }
     private:
         Expression left_, right_; // Левый и правый операнды
     };
@@ -314,19 +504,38 @@ private:
     // Класс, представляющий операцию возведения в степень
     class OperationPow : public ExpressionImpl {
     public:
-        OperationPow(Expression base, Expression exponent) : base_(base), exponent_(exponent) {}
+        OperationPow(Expression base, Expression exponent)
+            : ExpressionImpl(base.dependencies() | exponent.dependencies()), base_(base), exponent_(exponent) {}
 
         T eval(std::map<std::string, T> context) const override {
-            return std::pow(base_.eval(context), exponent_.eval(context));
+            return fast_pow(base_.eval(context), exponent_.eval(context)); // Целые степени — цепочкой умножений
         }
 
         std::string to_string() const override {
             return "(" + base_.to_string() + " ^ " + exponent_.to_string() + ")";
         }
 
-        Expression diff(const std::string& variable) const override {
-            Expression base_derivative = base_.diff(variable);
-            Expression exponent_derivative = exponent_.diff(variable);
+        Expression diff(const std::string& variable, unsigned index) const override {
+            // Постоянное основание: a^g(x) * (g'(x) * ln(a))
+            if (!base_.depends_on(index)) {
+                return (base_ ^ exponent_) * (exponent_.diff(variable, index) * base_.ln());
+            }
+
+            Expression base_derivative = base_.diff(variable, index);
+
+            // Постоянный показатель: степенное правило c * f(x)^(c - 1) * f'(x) без ln(f(x))
+            if (exponent_.kind() == Kind::Value) {
+                T exponent = exponent_.value();
+                if (exponent == T(0)) {
+                    return Expression(0.0); // f(x)^0 = 1, и f^-1 не должно давать NaN там, где f(x) = 0
+                }
+                return Expression(exponent) * (base_ ^ Expression(exponent - T(1))) * base_derivative;
+            }
+            if (!exponent_.depends_on(index)) {
+                return exponent_ * (base_ ^ (exponent_ - Expression(1.0))) * base_derivative;
+            }
+
+            Expression exponent_derivative = exponent_.diff(variable, index);
 
             // Формула сложного дифференцирования: f(x)^g(x) * (g'(x) * ln(f(x)) + g(x) * f'(x) / f(x))
             Expression part1 = exponent_derivative * base_.ln();
@@ -351,6 +560,9 @@ private:
             return base ^ exponent;
         }
 
+        Kind kind() const override { return Kind::Pow; }
+        std::vector<Expression> operands() const override { return {base_, exponent_}; }
+
     private:
         Expression base_, exponent_;
     };
@@ -358,19 +570,21 @@ private:
     // Класс, представляющий операцию синуса
     class OperationSin : public ExpressionImpl {
     public:
-        OperationSin(Expression arg) : arg_(arg) {} // Конструктор для синуса
+        OperationSin(Expression arg) : ExpressionImpl(arg.dependencies()), arg_(arg) {} // Конструктор для синуса
         T eval(std::map<std::string, T> context) const override {
             return std::sin(arg_.eval(context)); // Вычисляем синус
         }
         std::string to_string() const override {
             return "sin(" + arg_.to_string() + ")"; // Возвращаем строку вида "sin(a)"
         }
-        Expression diff(const std::string& variable) const override {
-            return arg_.cos() * arg_.diff(variable); // Производная синуса
+        Expression diff(const std::string& variable, unsigned index) const override {
+            return arg_.cos() * arg_.diff(variable, index); // Производная синуса
         }
         Expression simplify() const override {
             return arg_.simplify().sin(); // Упрощаем аргумент и возвращаем синус
         }
+        Kind kind() const override { return Kind::Sin; }
+        std::vector<Expression> operands() const override { return {arg_}; }
     private:
         Expression arg_; // Аргумент синуса
     };
@@ -378,19 +592,21 @@ private:
     // Класс, представляющий операцию косинуса
     class OperationCos : public ExpressionImpl {
     public:
-        OperationCos(Expression arg) : arg_(arg) {} // Конструктор для косинуса
+        OperationCos(Expression arg) : ExpressionImpl(arg.dependencies()), arg_(arg) {} // Конструктор для косинуса
         T eval(std::map<std::string, T> context) const override {
             return std::cos(arg_.eval(context)); // Вычисляем косинус
         }
         std::string to_string() const override {
             return "cos(" + arg_.to_string() + ")"; // Возвращаем строку вида "cos(a)"
         }
-        Expression diff(const std::string& variable) const override {
-            return Expression(-1.0) * arg_.sin() * arg_.diff(variable); // Производная косинуса
+        Expression diff(const std::string& variable, unsigned index) const override {
+            return Expression(-1.0) * arg_.sin() * arg_.diff(variable, index); // Производная косинуса
         }
         Expression simplify() const override {
             return arg_.simplify().cos(); // Упрощаем аргумент и возвращаем косинус
         }
+        Kind kind() const override { return Kind::Cos; }
+        std::vector<Expression> operands() const override { return {arg_}; }
     private:
         Expression arg_; // Аргумент косинуса
     };
@@ -398,19 +614,21 @@ private:
     // Класс, представляющий операцию натурального логарифма
     class OperationLn : public ExpressionImpl {
     public:
-        OperationLn(Expression arg) : arg_(arg) {} // Конструктор для логарифма
+        OperationLn(Expression arg) : ExpressionImpl(arg.dependencies()), arg_(arg) {} // Конструктор для логарифма
         T eval(std::map<std::string, T> context) const override {
             return std::log(arg_.eval(context)); // Вычисляем логарифм
         }
         std::string to_string() const override {
             return "ln(" + arg_.to_string() + ")"; // Возвращаем строку вида "ln(a)"
         }
-        Expression diff(const std::string& variable) const override {
-            return (Expression(1.0) / arg_) * arg_.diff(variable); // Производная логарифма
+        Expression diff(const std::string& variable, unsigned index) const override {
+            return (Expression(1.0) / arg_) * arg_.diff(variable, index); // Производная логарифма
         }
         Expression simplify() const override {
             return arg_.simplify().ln(); // Упрощаем аргумент и возвращаем логарифм
         }
+        Kind kind() const override { return Kind::Ln; }
+        std::vector<Expression> operands() const override { return {arg_}; }
     private:
         Expression arg_; // Аргумент логарифма
     };
@@ -418,19 +636,21 @@ private:
     // Класс, представляющий операцию экспоненты
     class OperationExp : public ExpressionImpl {
     public:
-        OperationExp(Expression arg) : arg_(arg) {} // Конструктор для экспоненты
+        OperationExp(Expression arg) : ExpressionImpl(arg.dependencies()), arg_(arg) {} // Конструктор для экспоненты
         T eval(std::map<std::string, T> context) const override {
             return std::exp(arg_.eval(context)); // Вычисляем экспоненту
         }
         std::string to_string() const override {
             return "exp(" + arg_.to_string() + ")"; // Возвращаем строку вида "exp(a)"
         }
-        Expression diff(const std::string& variable) const override {
-            return arg_.exp() * arg_.diff(variable); // Производная экспоненты
+        Expression diff(const std::string& variable, unsigned index) const override {
+            return arg_.exp() * arg_.diff(variable, index); // Производная экспоненты
         }
         Expression simplify() const override {
             return arg_.simplify().exp(); // Упрощаем аргумент и возвращаем экспоненту
         }
+        Kind kind() const override { return Kind::Exp; }
+        std::vector<Expression> operands() const override { return {arg_}; }
     private:
         Expression arg_; // Аргумент экспоненты
     };
@@ -444,6 +664,8 @@ public:
 // Объявления пользовательских литералов
 Expression<double> operator"" _val(long double val);
 Expression<double> operator"" _var(const char* variable, size_t size);
+Expression<float> operator"" _val_f(long double val);
+Expression<float> operator"" _var_f(const char* variable, size_t size);
 Expression<std::complex<double>> operator"" _val_c(long double val);
 Expression<std::complex<double>> operator"" _var_c(const char* variable, size_t size);
 
@@ -0,0 +1,200 @@
+#ifndef JACOBIAN_HPP
+#define JACOBIAN_HPP
+
+#include "expression.hpp"
+#include "compiled.hpp"
+#include <algorithm>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Разреженная матрица в формате CSR
+template<typename V>
+struct CsrMatrix {
+    size_t rows = 0, cols = 0;
+    std::vector<size_t> row_ptr;   // Начало каждой строки в col_index и values (rows + 1 элементов)
+    std::vector<size_t> col_index; // Номера столбцов ненулевых элементов
+    std::vector<V> values;         // Значения ненулевых элементов
+};
+
+// Система выражений (вектор-функция) с разреженной матрицей Якоби.
+// Портрет матрицы определяется по тому, какие переменные встречаются в каждом выходе;
+// столбцы раскрашиваются так, что столбцы одного цвета не пересекаются по строкам,
+// и все производные одного цвета получаются одним проходом прямого режима
+template<typename T>
+class ExpressionSystem {
+public:
+    // variables задаёт порядок столбцов; если пусто — все переменные системы по алфавиту
+    explicit ExpressionSystem(std::vector<Expression<T>> outputs, std::vector<std::string> variables = {})
+        : outputs_(std::move(outputs)), variables_(std::move(variables)), compiled_(outputs_) {
+        detect_sparsity();
+        color_columns();
+    }
+
+    size_t size() const { return outputs_.size(); }
+    const std::vector<Expression<T>>& outputs() const { return outputs_; }
+    const std::vector<std::string>& variables() const { return variables_; }
+
+    // Портрет матрицы Якоби: для каждой строки — отсортированные номера столбцов
+    const std::vector<std::vector<size_t>>& sparsity() const { return pattern_; }
+    size_t nonzeros() const {
+        size_t count = 0;
+        for (const auto& row : pattern_) {
+            count += row.size();
+        }
+        return count;
+    }
+
+    // Цвет каждого столбца и число цветов (проходов прямого режима)
+    const std::vector<size_t>& colors() const { return colors_; }
+    size_t color_count() const { return color_count_; }
+
+    // Значения всех выходов
+    std::vector<T> eval(const std::map<std::string, T>& context) const {
+        return compiled_.eval_all(context);
+    }
+
+    // Численная матрица Якоби в точке: color_count() направлений за один проход по программе
+    CsrMatrix<T> jacobian(const std::map<std::string, T>& context) const {
+        const std::vector<std::string>& inputs = compiled_.variables();
+        std::vector<T> seeds(inputs.size() * color_count_, T(0));
+        for (size_t v = 0; v < inputs.size(); ++v) {
+            auto iter = columns_.find(inputs[v]);
+            if (iter != columns_.end()) {
+                seeds[v * color_count_ + colors_[iter->second]] = T(1); // Направление = сумма столбцов одного цвета
+            }
+        }
+        std::vector<T> tangents;
+        compiled_.eval_directional(context, seeds, color_count_, tangents);
+
+        CsrMatrix<T> result = empty_matrix<T>();
+        for (size_t row = 0; row < pattern_.size(); ++row) {
+            for (size_t col : pattern_[row]) {
+                result.values.push_back(tangents[row * color_count_ + colors_[col]]);
+            }
+        }
+        return result;
+    }
+
+    // Символьная матрица Якоби: diff вызывается только для ненулевых элементов портрета
+    CsrMatrix<Expression<T>> symbolic_jacobian() const {
+        CsrMatrix<Expression<T>> result = empty_matrix<Expression<T>>();
+        for (size_t row = 0; row < pattern_.size(); ++row) {
+            for (size_t col : pattern_[row]) {
+                result.values.push_back(outputs_[row].diff(variables_[col]).simplify());
+            }
+        }
+        return result;
+    }
+
+private:
+    // Матрица с портретом системы и пустым массивом значений
+    template<typename V>
+    CsrMatrix<V> empty_matrix() const {
+        CsrMatrix<V> result;
+        result.rows = pattern_.size();
+        result.cols = variables_.size();
+        result.row_ptr.push_back(0);
+        for (const auto& row : pattern_) {
+            result.col_index.insert(result.col_index.end(), row.begin(), row.end());
+            result.row_ptr.push_back(result.col_index.size());
+        }
+        result.values.reserve(result.col_index.size());
+        return result;
+    }
+
+    // Собирает переменные каждого выхода обходом дерева (общие подвыражения посещаются один раз)
+    void detect_sparsity() {
+        std::vector<std::set<std::string>> used(outputs_.size());
+        for (size_t row = 0; row < outputs_.size(); ++row) {
+            std::set<const void*> visited;
+            std::vector<Expression<T>> stack{outputs_[row]};
+            while (!stack.empty()) {
+                Expression<T> expr = stack.back();
+                stack.pop_back();
+                if (!visited.insert(expr.id()).second) {
+                    continue;
+                }
+                if (expr.kind() == Expression<T>::Kind::Variable) {
+                    used[row].insert(expr.name());
+                }
+                for (const Expression<T>& operand : expr.operands()) {
+                    stack.push_back(operand);
+                }
+            }
+        }
+
+        if (variables_.empty()) {
+            std::set<std::string> all;
+            for (const auto& names : used) {
+                all.insert(names.begin(), names.end());
+            }
+            variables_.assign(all.begin(), all.end());
+        }
+        for (size_t col = 0; col < variables_.size(); ++col) {
+            if (!columns_.emplace(variables_[col], col).second) {
+                throw std::invalid_argument("Duplicate variable \"" + variables_[col] + "\"");
+            }
+        }
+
+        pattern_.assign(outputs_.size(), {});
+        for (size_t row = 0; row < outputs_.size(); ++row) {
+            for (const std::string& name : used[row]) {
+                auto iter = columns_.find(name);
+                if (iter != columns_.end()) {
+                    pattern_[row].push_back(iter->second);
+                }
+            }
+            std::sort(pattern_[row].begin(), pattern_[row].end());
+        }
+    }
+
+    // Жадная раскраска графа пересечений столбцов, столбцы с большим числом ненулей — первыми
+    void color_columns() {
+        std::vector<std::vector<size_t>> rows_of(variables_.size());
+        for (size_t row = 0; row < pattern_.size(); ++row) {
+            for (size_t col : pattern_[row]) {
+                rows_of[col].push_back(row);
+            }
+        }
+        std::vector<size_t> order(variables_.size());
+        for (size_t col = 0; col < order.size(); ++col) {
+            order[col] = col;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return rows_of[a].size() > rows_of[b].size();
+        });
+
+        const size_t uncolored = variables_.size();
+        colors_.assign(variables_.size(), uncolored);
+        color_count_ = 0;
+        std::vector<size_t> forbidden(variables_.size() + 1, uncolored); // forbidden[c] == col — цвет c занят соседом col
+        for (size_t col : order) {
+            for (size_t row : rows_of[col]) {
+                for (size_t neighbour : pattern_[row]) {
+                    if (colors_[neighbour] != uncolored) {
+                        forbidden[colors_[neighbour]] = col;
+                    }
+                }
+            }
+            size_t color = 0;
+            while (forbidden[color] == col) {
+                ++color;
+            }
+            colors_[col] = color;
+            color_count_ = std::max(color_count_, color + 1);
+        }
+    }
+
+    std::vector<Expression<T>> outputs_;
+    std::vector<std::string> variables_;
+    CompiledExpression<T> compiled_;
+    std::map<std::string, size_t> columns_; // Номер столбца по имени переменной
+    std::vector<std::vector<size_t>> pattern_;
+    std::vector<size_t> colors_;
+    size_t color_count_ = 0;
+};
+
+#endif // JACOBIAN_HPP
@@ -1,10 +1,11 @@
 #include "expression.hpp"
+#include "columnar.hpp"
 #include <iostream>
 #include <map>
 #include <cstring>
 
 // Функция для разбора аргументов командной строки
-void parse_arguments(int argc, char* argv[], std::string& expression, std::map<std::string, double>& variables, bool& eval_mode, bool& diff_mode, std::string& diff_by) {
+void parse_arguments(int argc, char* argv[], std::string& expression, std::map<std::string, double>& variables, bool& eval_mode, bool& diff_mode, std::string& diff_by, bool& single_precision, bool& batch_mode, std::map<std::string, std::string>& columns, std::string& output) {
     for (int i = 1; i < argc; ++i) {
         if (std::strcmp(argv[i], "--eval") == 0) {
             eval_mode = true;
@@ -14,6 +15,18 @@ void parse_arguments(int argc, char* argv[], std::string& expression, std::map<s
             expression = argv[++i];
         } else if (std::strcmp(argv[i], "--by") == 0) {
             diff_by = argv[++i];
+        } else if (std::strcmp(argv[i], "--float") == 0) {
+            single_precision = true;
+        } else if (std::strcmp(argv[i], "--batch") == 0) {
+            batch_mode = true;
+            expression = argv[++i];
+        } else if (std::strcmp(argv[i], "--column") == 0) {
+            // Привязка столбца к переменной (например, x=points_x.npy)
+            std::string binding = argv[++i];
+            size_t separator = binding.find('=');
+            columns[binding.substr(0, separator)] = separator == std::string::npos ? "" : binding.substr(separator + 1);
+        } else if (std::strcmp(argv[i], "--output") == 0) {
+            output = argv[++i];
         } else if (std::strstr(argv[i], "=") != nullptr) {
             // Обработка переменных (например, x=10)
             char* name = strtok(argv[i], "=");
@@ -25,7 +38,7 @@ void parse_arguments(int argc, char* argv[], std::string& expression, std::map<s
 
 int main(int argc, char* argv[]) {
     if (argc < 2) {
-        std::cerr << "Usage: differentiator --eval <expression> [x=value y=value ...] OR differentiator --diff <expression> --by <variable>" << std::endl;
+        std::cerr << "Usage: differentiator --eval <expression> [--float] [x=value y=value ...] OR differentiator --diff <expression> --by <variable> OR differentiator --batch <expression> --column x=<file> [--column y=<file> ...] --output <file>" << std::endl;
         return EXIT_FAILURE;
     }
 
@@ -34,11 +47,23 @@ int main(int argc, char* argv[]) {
     bool eval_mode = false;
     bool diff_mode = false;
     std::string diff_by;
+    bool single_precision = false;
+    bool batch_mode = false;
+    std::map<std::string, std::string> columns;
+    std::string output;
 
-    parse_arguments(argc, argv, expression, variables, eval_mode, diff_mode, diff_by);
+    parse_arguments(argc, argv, expression, variables, eval_mode, diff_mode, diff_by, single_precision, batch_mode, columns, output);
 
     try {
-        if (eval_mode) {
+        if (eval_mode && single_precision) {
+            // Вычисление выражения в float
+            Expression<float> expr = Expression<float>::from_string(expression);
+            std::map<std::string, float> float_variables;
+            for (const auto& [name, value] : variables) {
+                float_variables[name] = static_cast<float>(value);
+            }
+            std::cout << expr.eval(float_variables) << std::endl;
+        } else if (eval_mode) {
             // Вычисление выражения
             Expression<double> expr = Expression<double>::from_string(expression);
             double result = expr.eval(variables);
@@ -48,8 +73,16 @@ int main(int argc, char* argv[]) {
             Expression<double> expr = Expression<double>::from_string(expression);
             Expression<double> derivative = expr.diff(diff_by).simplify();
             std::cout << derivative.to_string() << std::endl;
+        } else if (batch_mode) {
+            // Пакетное вычисление над столбцами в файлах
+            ColumnarBatch batch;
+            for (const auto& [name, path] : columns) {
+                batch.bind(name, path);
+            }
+            ColumnarBatch::Report report = batch.evaluate(CompiledExpression<double>(Expression<double>::from_string(expression)), output);
+            std::cout << report.points << " points in " << report.seconds << " s" << std::endl;
         } else {
-            std::cerr << "Invalid mode. Use --eval or --diff." << std::endl;
+            std::cerr << "Invalid mode. Use --eval, --diff or --batch." << std::endl;
             return EXIT_FAILURE;
         }
     } catch (const std::exception& e) {
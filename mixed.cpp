@@ -0,0 +1,95 @@
+#include "mixed.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+MixedPrecisionExpression::MixedPrecisionExpression(const Expression<double>& expr, double tolerance)
+    : precise_(expr), fast_(precise_.cast<float>()), tolerance_(tolerance) {}
+
+MixedPrecisionExpression::Report MixedPrecisionExpression::eval_batch(const std::vector<const double*>& columns, double* out,
+                                                                      size_t count, double* errors,
+                                                                      unsigned char* recomputed) const {
+    if (columns.size() != variables().size()) {
+        throw std::invalid_argument("Expected " + std::to_string(variables().size()) + " input columns");
+    }
+    // Программа во float читает столбцы double сама, приводя значения при загрузке в слоты
+    const size_t block = 16 * CompiledExpression<float>::kBlockSize;
+    Report report;
+    report.points = count;
+
+    // Проверка допуска целиком во float. Допуск слегка уменьшен, чтобы округления при приведении
+    // и умножении не ослабили его; бесконечная оценка не проходит из-за ограничения сверху
+    const float tolerance = static_cast<float>(tolerance_ * (1 - std::numeric_limits<float>::epsilon()));
+    const float largest = std::numeric_limits<float>::max();
+
+    std::vector<const double*> fast_columns(columns.size());
+    std::vector<float> values(block), bounds(block);
+    std::vector<std::vector<double>> retry(columns.size());
+    std::vector<const double*> retry_columns(columns.size());
+    std::vector<size_t> retry_points;
+    std::vector<double> retry_values;
+
+    for (size_t start = 0; start < count; start += block) {
+        size_t lanes = std::min(block, count - start);
+        for (size_t v = 0; v < columns.size(); ++v) {
+            fast_columns[v] = columns[v] + start;
+        }
+        fast_.eval_batch_with_error(fast_columns, values.data(), bounds.data(), lanes);
+
+        // Результаты и оценки копируются простыми циклами; точки с недостаточной точностью
+        // собираются и пересчитываются одним пакетом в double
+        std::copy(values.begin(), values.begin() + lanes, out + start);
+        if (errors) {
+            std::copy(bounds.begin(), bounds.begin() + lanes, errors + start);
+        }
+        auto precise = [&](size_t l) { return bounds[l] <= std::min(tolerance * std::abs(values[l]), largest); };
+        retry_points.clear();
+        size_t l = 0;
+        for (; l + kCheckWidth <= lanes; l += kCheckWidth) {
+            // Сначала вся группа одним векторизуемым циклом, поточечно — только если в ней есть промах
+            int all = 1;
+            for (size_t k = 0; k < kCheckWidth; ++k) {
+                all &= precise(l + k);
+            }
+            if (!all) {
+                for (size_t k = 0; k < kCheckWidth; ++k) {
+                    if (!precise(l + k)) {
+                        retry_points.push_back(start + l + k);
+                    }
+                }
+            }
+        }
+        for (; l < lanes; ++l) {
+            if (!precise(l)) {
+                retry_points.push_back(start + l);
+            }
+        }
+        if (recomputed) {
+            std::fill(recomputed + start, recomputed + start + lanes, 0);
+            for (size_t point : retry_points) {
+                recomputed[point] = 1;
+            }
+        }
+        if (retry_points.empty()) {
+            continue;
+        }
+        for (size_t v = 0; v < columns.size(); ++v) {
+            retry[v].resize(retry_points.size());
+            for (size_t k = 0; k < retry_points.size(); ++k) {
+                retry[v][k] = columns[v][retry_points[k]];
+            }
+            retry_columns[v] = retry[v].data();
+        }
+        retry_values.resize(retry_points.size());
+        precise_.eval_batch(retry_columns, retry_values.data(), retry_points.size());
+        for (size_t k = 0; k < retry_points.size(); ++k) {
+            out[retry_points[k]] = retry_values[k];
+            if (errors) {
+                errors[retry_points[k]] = 0;
+            }
+        }
+        report.recomputed += retry_points.size();
+    }
+    return report;
+}
@@ -0,0 +1,39 @@
+#ifndef MIXED_HPP
+#define MIXED_HPP
+
+#include "expression.hpp"
+#include "compiled.hpp"
+#include <string>
+#include <vector>
+
+// Вычисление со смешанной точностью: основной проход в float (вдвое больше точек на SIMD-регистр),
+// с оценкой погрешности в каждой точке; точки, где оценка превышает допуск, пересчитываются в double
+class MixedPrecisionExpression {
+public:
+    // Итог пакетного вычисления
+    struct Report {
+        size_t points = 0;     // Число вычисленных точек
+        size_t recomputed = 0; // Сколько из них пересчитано в double
+    };
+
+    // tolerance — допустимая относительная погрешность результата в float
+    explicit MixedPrecisionExpression(const Expression<double>& expr, double tolerance = 1e-5);
+
+    const std::vector<std::string>& variables() const { return precise_.variables(); }
+    double tolerance() const { return tolerance_; }
+
+    // Пакетное вычисление: columns[i] — значения переменной variables()[i] в count точках.
+    // Если errors не пусто, туда записывается оценка абсолютной погрешности (0 для пересчитанных точек);
+    // если recomputed не пусто, там отмечаются точки, пересчитанные в double
+    Report eval_batch(const std::vector<const double*>& columns, double* out, size_t count,
+                      double* errors = nullptr, unsigned char* recomputed = nullptr) const;
+
+private:
+    static constexpr size_t kCheckWidth = 8; // Точек в группе при проверке допуска
+
+    CompiledExpression<double> precise_; // Программа в double для пересчёта
+    CompiledExpression<float> fast_;     // Та же программа в float
+    double tolerance_;
+};
+
+#endif // MIXED_HPP
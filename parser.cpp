@@ -4,23 +4,27 @@
 #include <stdexcept>
 
 // Конструктор, инициализирующий входную строку и начальную позицию
-Parser::Parser(const std::string& input) : input(input), pos(0) {}
+template<typename T>
+BasicParser<T>::BasicParser(const std::string& input) : input(input), pos(0) {}
 
 // Пропускает все пробелы в текущей позиции
-void Parser::skip_whitespace() {
+template<typename T>
+void BasicParser<T>::skip_whitespace() {
     while (pos < input.size() && std::isspace(input[pos])) {
         pos++;
     }
 }
 
 // Возвращает текущий символ без его потребления
-char Parser::peek() {
+template<typename T>
+char BasicParser<T>::peek() {
     skip_whitespace();  // Пропускаем пробелы перед чтением
     return (pos < input.size()) ? input[pos] : '\0';  // Возвращаем текущий символ или нулевой символ, если строка закончилась
 }
 
 // Потребляет текущий символ и возвращает его
-char Parser::consume() {
+template<typename T>
+char BasicParser<T>::consume() {
     skip_whitespace();  // Пропускаем пробелы перед чтением
     if (pos >= input.size()) {
         throw std::runtime_error("Unexpected end of input");  // Если строка закончилась, выбрасываем исключение
@@ -29,7 +33,8 @@ char Parser::consume() {
 }
 
 // Проверяет, совпадает ли текущий символ с ожидаемым, и потребляет его, если да
-bool Parser::match(char expected) {
+template<typename T>
+bool BasicParser<T>::match(char expected) {
     skip_whitespace();  // Пропускаем пробелы перед проверкой
     if (pos < input.size() && input[pos] == expected) {
         pos++;  // Потребляем символ, если он совпадает с ожидаемым
@@ -39,13 +44,15 @@ bool Parser::match(char expected) {
 }
 
 // Основной метод, который запускает парсинг выражения
-Expression<double> Parser::parse() {
+template<typename T>
+Expression<T> BasicParser<T>::parse() {
     return parse_expression();  // Начинаем с парсинга выражения
 }
 
 // Парсит выражение, состоящее из термов, соединенных операциями сложения и вычитания
-Expression<double> Parser::parse_expression() {
-    Expression<double> left = parse_term();  // Парсим первый терм
+template<typename T>
+Expression<T> BasicParser<T>::parse_expression() {
+    Expression<T> left = parse_term();  // Парсим первый терм
     while (true) {
         if (match('+')) {
             left = left + parse_term();  // Если встретили +, добавляем следующий терм
@@ -59,8 +66,9 @@ Expression<double> Parser::parse_expression() {
 }
 
 // Парсит терм, состоящий из факторов, соединенных операциями умножения и деления
-Expression<double> Parser::parse_term() {
-    Expression<double> left = parse_factor();  // Парсим первый фактор
+template<typename T>
+Expression<T> BasicParser<T>::parse_term() {
+    Expression<T> left = parse_factor();  // Парсим первый фактор
     while (true) {
         if (match('*')) {
             left = left * parse_factor();  // Если встретили *, умножаем на следующий фактор
@@ -74,8 +82,9 @@ Expression<double> Parser::parse_term() {
 }
 
 // Парсит фактор, который может быть возведен в степень
-Expression<double> Parser::parse_factor() {
-    Expression<double> left = parse_primary();  // Парсим первичное выражение
+template<typename T>
+Expression<T> BasicParser<T>::parse_factor() {
+    Expression<T> left = parse_primary();  // Парсим первичное выражение
     if (match('^')) {
         left = left ^ parse_factor();  // Если встретили ^, возводим в степень следующий фактор
     }
@@ -83,9 +92,10 @@ Expression<double> Parser::parse_factor() {
 }
 
 // Парсит первичное выражение: число, переменную, функцию или выражение в скобках
-Expression<double> Parser::parse_primary() {
+template<typename T>
+Expression<T> BasicParser<T>::parse_primary() {
     if (match('(')) {
-        Expression<double> expr = parse_expression();  // Если встретили (, парсим выражение в скобках
+        Expression<T> expr = parse_expression();  // Если встретили (, парсим выражение в скобках
         if (!match(')')) {
             throw std::runtime_error("Expected ')'");  // Если после выражения нет ), выбрасываем исключение
         }
@@ -106,7 +116,8 @@ Expression<double> Parser::parse_primary() {
 }
 
 // Парсит вызов функции (sin, cos, ln, exp)
-Expression<double> Parser::parse_function() {
+template<typename T>
+Expression<T> BasicParser<T>::parse_function() {
     std::string func;
     while (std::isalpha(peek())) {
         func += consume();  // Собираем имя функции
@@ -127,17 +138,23 @@ Expression<double> Parser::parse_function() {
 }
 
 // Парсит число
-Expression<double> Parser::parse_number() {
+template<typename T>
+Expression<T> BasicParser<T>::parse_number() {
     std::string num;
     while (std::isdigit(peek()) || peek() == '.') {
         num += consume();  // Собираем цифры и точки в строку
     }
-    return Expression<double>(std::stod(num));  // Преобразуем строку в число и возвращаем его
+    return Expression<T>(static_cast<T>(std::stod(num)));  // Преобразуем строку в число и возвращаем его
 }
 
 // Парсит переменную (x, y)
-Expression<double> Parser::parse_variable() {
+template<typename T>
+Expression<T> BasicParser<T>::parse_variable() {
     std::string var;
     var += consume();  // Потребляем символ переменной
-    return Expression<double>(var);  // Возвращаем переменную
+    return Expression<T>(var);  // Возвращаем переменную
 }
+
+// Явные инстанцирования для поддерживаемых типов
+template class BasicParser<double>;
+template class BasicParser<float>;
@@ -7,13 +7,15 @@
 #include <memory>
 #include <stdexcept>
 
-class Parser {
+// Парсер выражений; реализован в parser.cpp для double и float
+template<typename T>
+class BasicParser {
 public:
     // Конструктор, принимающий входную строку для парсинга
-    Parser(const std::string& input);
+    BasicParser(const std::string& input);
 
     // Основной метод, который запускает парсинг выражения
-    Expression<double> parse();
+    Expression<T> parse();
 
 private:
     std::string input;  // Входная строка, которую нужно распарсить
@@ -32,13 +34,15 @@ private:
     bool match(char expected);
 
     // Рекурсивные методы для парсинга различных частей выражения
-    Expression<double> parse_expression();  // Парсит выражение (сложение и вычитание)
-    Expression<double> parse_term();        // Парсит терм (умножение и деление)
-    Expression<double> parse_factor();      // Парсит фактор (степень)
-    Expression<double> parse_primary();     // Парсит первичное выражение (число, переменная, функция, скобки)
-    Expression<double> parse_function();    // Парсит вызов функции (sin, cos, ln, exp)
-    Expression<double> parse_number();     // Парсит число
-    Expression<double> parse_variable();   // Парсит переменную (x, y)
+    Expression<T> parse_expression();  // Парсит выражение (сложение и вычитание)
+    Expression<T> parse_term();        // Парсит терм (умножение и деление)
+    Expression<T> parse_factor();      // Парсит фактор (степень)
+    Expression<T> parse_primary();     // Парсит первичное выражение (число, переменная, функция, скобки)
+    Expression<T> parse_function();    // Парсит вызов функции (sin, cos, ln, exp)
+    Expression<T> parse_number();     // Парсит число
+    Expression<T> parse_variable();   // Парсит переменную (x, y)
 };
 
+using Parser = BasicParser<double>;
+
 #endif // PARSER_HPP
@@ -0,0 +1,173 @@
+#include "pipeline.hpp"
+#include "polynomial.hpp"
+#include <set>
+#include <stdexcept>
+
+namespace {
+
+// Ожидание при пустой или заполненной очереди: сначала уступаем процессор, затем засыпаем
+void backoff(unsigned& attempt) {
+    if (++attempt < 64) {
+        std::this_thread::yield();
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+}
+
+} // namespace
+
+FormulaPipeline::FormulaPipeline(Options options, Sink sink) : sink_(std::move(sink)), started_(std::chrono::steady_clock::now()) {
+    const char* names[] = {"parse", "diff", "compile", "eval"};
+    void (*work[])(WorkItem&) = {&FormulaPipeline::parse, &FormulaPipeline::differentiate, &FormulaPipeline::compile,
+                                 &FormulaPipeline::evaluate};
+    size_t workers[] = {options.parse_workers, options.diff_workers, options.compile_workers, options.eval_workers};
+
+    for (size_t i = 0; i < 4; ++i) {
+        queues_.push_back(std::make_unique<BoundedQueue<WorkItem*>>(options.queue_capacity));
+    }
+    for (size_t i = 0; i < 4; ++i) {
+        auto stage = std::make_unique<Stage>();
+        stage->name = names[i];
+        stage->work = work[i];
+        stage->input = queues_[i].get();
+        stage->output = i + 1 < 4 ? queues_[i + 1].get() : nullptr;
+        stages_.push_back(std::move(stage));
+    }
+    for (size_t i = 0; i < 4; ++i) {
+        start_stage(*stages_[i], workers[i] == 0 ? 1 : workers[i]);
+    }
+}
+
+FormulaPipeline::~FormulaPipeline() {
+    finish();
+}
+
+void FormulaPipeline::submit(FormulaJob job) {
+    if (finished_) {
+        throw std::logic_error("Pipeline input is closed");
+    }
+    // Набор переменных не зависит от порядка и повторов: каждая производная считается один раз
+    std::set<std::string> unique(job.diff_variables.begin(), job.diff_variables.end());
+    job.diff_variables.assign(unique.begin(), unique.end());
+    WorkItem* item = new WorkItem();
+    item->result.id = job.id;
+    item->job = std::move(job);
+    push(*queues_.front(), item, nullptr);
+}
+
+void FormulaPipeline::finish() {
+    if (finished_) {
+        return;
+    }
+    finished_ = true;
+    queues_.front()->close();
+    for (auto& stage : stages_) {
+        for (std::thread& thread : stage->threads) {
+            thread.join(); // Стадии завершаются по порядку: каждая закрывает очередь следующей
+        }
+    }
+}
+
+std::vector<FormulaPipeline::StageMetrics> FormulaPipeline::metrics() const {
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started_).count();
+    std::vector<StageMetrics> result;
+    for (const auto& stage : stages_) {
+        StageMetrics metrics;
+        metrics.name = stage->name;
+        metrics.workers = stage->threads.size();
+        metrics.processed = stage->processed.load();
+        metrics.busy_seconds = stage->busy_ns.load() * 1e-9;
+        metrics.throughput = elapsed > 0 ? metrics.processed / elapsed : 0;
+        metrics.stalls = stage->stalls.load();
+        result.push_back(metrics);
+    }
+    return result;
+}
+
+void FormulaPipeline::start_stage(Stage& stage, size_t workers) {
+    stage.active = workers;
+    for (size_t i = 0; i < workers; ++i) {
+        stage.threads.emplace_back([this, &stage] { run_worker(stage); });
+    }
+}
+
+void FormulaPipeline::run_worker(Stage& stage) {
+    unsigned attempt = 0;
+    while (true) {
+        WorkItem* item;
+        if (!stage.input->try_pop(item)) {
+            if (!stage.input->closed()) {
+                backoff(attempt);
+                continue;
+            }
+            // Очередь закрыта только после последней вставки, поэтому повторная проверка ничего не теряет
+            if (!stage.input->try_pop(item)) {
+                break;
+            }
+        }
+        attempt = 0;
+
+        auto begin = std::chrono::steady_clock::now();
+        if (item->result.error.empty()) {
+            try {
+                stage.work(*item);
+            } catch (const std::exception& e) {
+                item->result.error = stage.name + ": " + e.what(); // Задание с ошибкой проходит остальные стадии без работы
+            }
+        }
+        stage.busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+        stage.processed.fetch_add(1, std::memory_order_relaxed);
+
+        if (stage.output) {
+            push(*stage.output, item, &stage.stalls);
+        } else {
+            std::unique_ptr<WorkItem> owner(item);
+            sink_(std::move(owner->result));
+        }
+    }
+    if (stage.active.fetch_sub(1) == 1 && stage.output) {
+        stage.output->close(); // Последний поток стадии закрывает очередь следующей
+    }
+}
+
+void FormulaPipeline::push(BoundedQueue<WorkItem*>& queue, WorkItem* item, std::atomic<size_t>* stalls) {
+    unsigned attempt = 0;
+    while (!queue.try_push(item)) {
+        if (attempt == 0 && stalls) {
+            stalls->fetch_add(1, std::memory_order_relaxed);
+        }
+        backoff(attempt);
+    }
+}
+
+void FormulaPipeline::parse(WorkItem& item) {
+    item.expression = Expression<double>::from_string(item.job.source);
+}
+
+void FormulaPipeline::differentiate(WorkItem& item) {
+    for (const std::string& variable : item.job.diff_variables) {
+        item.derivatives.push_back(normal_form_diff(*item.expression, variable));
+    }
+}
+
+void FormulaPipeline::compile(WorkItem& item) {
+    // Формула и производные компилируются в одну программу с общими подвыражениями
+    std::vector<Expression<double>> outputs{*item.expression};
+    outputs.insert(outputs.end(), item.derivatives.begin(), item.derivatives.end());
+    item.compiled.emplace(outputs);
+}
+
+void FormulaPipeline::evaluate(WorkItem& item) {
+    const std::vector<std::string>& variables = item.job.diff_variables;
+    for (const std::string& variable : variables) {
+        item.result.derivatives[variable].reserve(item.job.points.size());
+    }
+    item.result.values.reserve(item.job.points.size());
+    for (const auto& point : item.job.points) {
+        std::vector<double> values = item.compiled->eval_all(point);
+        item.result.values.push_back(values[0]);
+        for (size_t i = 0; i < variables.size(); ++i) {
+            item.result.derivatives[variables[i]].push_back(values[i + 1]);
+        }
+    }
+}
@@ -0,0 +1,190 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include "expression.hpp"
+#include "compiled.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Ограниченная очередь без блокировок для нескольких производителей и потребителей (схема Вьюкова).
+// T должен быть дешёвым для копирования (в конвейере это указатели)
+template<typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1; // Ёмкость округляется до степени двойки
+        }
+        mask_ = size - 1;
+        cells_.reset(new Cell[size]);
+        for (size_t i = 0; i < size; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    size_t capacity() const { return mask_ + 1; }
+
+    // Добавляет элемент; false, если очередь заполнена
+    bool try_push(const T& value) {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells_[pos & mask_];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.data = value;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Извлекает элемент; false, если очередь пуста
+    bool try_pop(T& value) {
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells_[pos & mask_];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = cell.data;
+                    cell.sequence.store(pos + mask_ + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Закрытие означает, что новых элементов не будет; оставшиеся ещё можно извлечь
+    void close() { closed_.store(true, std::memory_order_release); }
+    bool closed() const { return closed_.load(std::memory_order_acquire); }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_;
+    alignas(64) std::atomic<size_t> enqueue_pos_{0};
+    alignas(64) std::atomic<size_t> dequeue_pos_{0};
+    std::atomic<bool> closed_{false};
+};
+
+// Задание конвейера: формула, переменные дифференцирования и точки вычисления
+struct FormulaJob {
+    size_t id = 0;
+    std::string source;
+    std::vector<std::string> diff_variables;
+    std::vector<std::map<std::string, double>> points;
+};
+
+// Результат задания
+struct FormulaResult {
+    size_t id = 0;
+    std::vector<double> values;                              // Значение формулы в каждой точке
+    std::map<std::string, std::vector<double>> derivatives; // Значения производных в каждой точке
+    std::string error;                                       // Текст ошибки; пусто, если всё успешно
+};
+
+// Конвейер разбор -> дифференцирование -> компиляция -> вычисление для потока различных формул.
+// Между стадиями стоят ограниченные очереди без блокировок; у каждой стадии свой пул потоков.
+// Заполненная очередь задерживает предыдущую стадию (обратное давление)
+class FormulaPipeline {
+public:
+    // Число потоков каждой стадии и ёмкость очередей
+    struct Options {
+        size_t parse_workers = 1;
+        size_t diff_workers = 1;
+        size_t compile_workers = 1;
+        size_t eval_workers = 1;
+        size_t queue_capacity = 1024;
+    };
+
+    // Показатели стадии
+    struct StageMetrics {
+        std::string name;
+        size_t workers = 0;
+        size_t processed = 0;      // Обработано заданий
+        double busy_seconds = 0;   // Суммарное время работы потоков стадии
+        double throughput = 0;     // Заданий в секунду с момента запуска конвейера
+        size_t stalls = 0;         // Сколько раз стадия ждала места в следующей очереди
+    };
+
+    // sink вызывается из потоков последней стадии, поэтому должен быть потокобезопасным и не бросать исключений
+    using Sink = std::function<void(FormulaResult&&)>;
+
+    FormulaPipeline(Options options, Sink sink);
+    ~FormulaPipeline();
+
+    FormulaPipeline(const FormulaPipeline&) = delete;
+    FormulaPipeline& operator=(const FormulaPipeline&) = delete;
+
+    // Передаёт задание конвейеру; ждёт, если входная очередь заполнена
+    void submit(FormulaJob job);
+
+    // Закрывает вход и дожидается обработки всех заданий
+    void finish();
+
+    std::vector<StageMetrics> metrics() const;
+
+private:
+    // Задание вместе с промежуточными результатами стадий
+    struct WorkItem {
+        FormulaJob job;
+        std::optional<Expression<double>> expression;
+        std::vector<Expression<double>> derivatives;
+        std::optional<CompiledExpression<double>> compiled;
+        FormulaResult result;
+    };
+
+    struct Stage {
+        std::string name;
+        std::function<void(WorkItem&)> work;
+        BoundedQueue<WorkItem*>* input = nullptr;
+        BoundedQueue<WorkItem*>* output = nullptr; // nullptr — результаты уходят в sink
+        std::vector<std::thread> threads;
+        std::atomic<size_t> active{0};
+        std::atomic<size_t> processed{0};
+        std::atomic<uint64_t> busy_ns{0};
+        std::atomic<size_t> stalls{0};
+    };
+
+    void start_stage(Stage& stage, size_t workers);
+    void run_worker(Stage& stage);
+    static void push(BoundedQueue<WorkItem*>& queue, WorkItem* item, std::atomic<size_t>* stalls);
+
+    static void parse(WorkItem& item);
+    static void differentiate(WorkItem& item);
+    static void compile(WorkItem& item);
+    static void evaluate(WorkItem& item);
+
+    Sink sink_;
+    std::vector<std::unique_ptr<BoundedQueue<WorkItem*>>> queues_;
+    std::vector<std::unique_ptr<Stage>> stages_;
+    std::chrono::steady_clock::time_point started_;
+    bool finished_ = false;
+};
+
+#endif // PIPELINE_HPP
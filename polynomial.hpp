@@ -0,0 +1,553 @@
+#ifndef POLYNOMIAL_HPP
+#define POLYNOMIAL_HPP
+
+#include "expression.hpp"
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Максимальное число одночленов, при котором подвыражение ещё считается полиномом
+constexpr size_t kMaxPolynomialTerms = 256;
+
+// Умножение со сложением a * b + c: std::fma только там, где оно аппаратное (иначе это медленный вызов libm)
+template<typename T>
+T fused_multiply_add(const T& a, const T& b, const T& c) {
+#ifdef FP_FAST_FMA
+    if constexpr (std::is_same_v<T, double>) {
+        return std::fma(a, b, c);
+    }
+#endif
+#ifdef FP_FAST_FMAF
+    if constexpr (std::is_same_v<T, float>) {
+        return std::fma(a, b, c);
+    }
+#endif
+    return a * b + c;
+}
+
+// Число умножений при возведении в степень n бинарным способом
+inline size_t power_chain_length(unsigned long long n) {
+    size_t length = 0;
+    for (unsigned long long m = n; m > 1; m >>= 1) {
+        length += (m & 1) ? 2 : 1;
+    }
+    return length;
+}
+
+// Степени переменных одночлена (нулевые не хранятся)
+using Monomial = std::map<std::string, unsigned>;
+
+// Хеш одночлена
+struct MonomialHash {
+    size_t operator()(const Monomial& monomial) const {
+        size_t seed = monomial.size();
+        for (const auto& [name, power] : monomial) {
+            seed ^= std::hash<std::string>()(name) + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2);
+            seed ^= power + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2);
+        }
+        return seed;
+    }
+};
+
+// Разреженный многочлен от нескольких переменных: хеш-таблица одночлен -> коэффициент.
+// Служит нормальной формой полиномиальных выражений: дифференцирование — O(число одночленов)
+template<typename T>
+class Polynomial {
+public:
+    using Monomial = ::Monomial;
+    using Terms = std::unordered_map<Monomial, T, MonomialHash>; // Ненулевые коэффициенты одночленов
+
+    Polynomial() = default; // Нулевой многочлен
+    Polynomial(T constant) {
+        if (constant != T(0)) {
+            terms_[Monomial()] = constant; // Константа — коэффициент пустого одночлена
+        }
+    }
+
+    // Многочлен, равный одной переменной
+    static Polynomial variable(const std::string& name) {
+        Polynomial result;
+        result.terms_[Monomial{{name, 1}}] = T(1);
+        return result;
+    }
+
+    const Terms& terms() const { return terms_; }
+    size_t size() const { return terms_.size(); }
+    bool is_zero() const { return terms_.empty(); }
+    bool is_constant() const {
+        return terms_.empty() || (terms_.size() == 1 && terms_.begin()->first.empty());
+    }
+    T constant() const {
+        auto iter = terms_.find(Monomial());
+        return iter == terms_.end() ? T(0) : iter->second; // Свободный член
+    }
+
+    // Переменные, входящие в многочлен
+    std::set<std::string> variables() const {
+        std::set<std::string> result;
+        for (const auto& [monomial, coefficient] : terms_) {
+            for (const auto& [name, power] : monomial) {
+                result.insert(name);
+            }
+        }
+        return result;
+    }
+
+    bool operator==(const Polynomial& that) const { return terms_ == that.terms_; }
+    bool operator!=(const Polynomial& that) const { return !(*this == that); }
+
+    // Арифметические операции
+    Polynomial operator-() const {
+        Polynomial result(*this);
+        for (auto& [monomial, coefficient] : result.terms_) {
+            coefficient = -coefficient;
+        }
+        return result;
+    }
+    Polynomial operator+(const Polynomial& that) const {
+        Polynomial result(*this);
+        for (const auto& [monomial, coefficient] : that.terms_) {
+            result.add_term(monomial, coefficient);
+        }
+        return result;
+    }
+    Polynomial operator-(const Polynomial& that) const {
+        return *this + (-that);
+    }
+    Polynomial operator*(const Polynomial& that) const {
+        Polynomial result;
+        for (const auto& [left_monomial, left_coefficient] : terms_) {
+            for (const auto& [right_monomial, right_coefficient] : that.terms_) {
+                Monomial monomial = left_monomial;
+                for (const auto& [name, power] : right_monomial) {
+                    monomial[name] += power;
+                }
+                result.add_term(monomial, left_coefficient * right_coefficient);
+            }
+        }
+        return result;
+    }
+
+    // Частная производная: степень переменной в каждом одночлене уменьшается на единицу
+    Polynomial diff(const std::string& variable) const {
+        Polynomial result;
+        for (const auto& [monomial, coefficient] : terms_) {
+            auto iter = monomial.find(variable);
+            if (iter == monomial.end()) {
+                continue;
+            }
+            Monomial reduced = monomial;
+            if (iter->second == 1) {
+                reduced.erase(variable);
+            } else {
+                --reduced[variable];
+            }
+            result.add_term(reduced, coefficient * T(iter->second));
+        }
+        return result;
+    }
+
+    // Возведение в неотрицательную целую степень; пустой результат, если число одночленов превысило max_terms
+    std::optional<Polynomial> pow(unsigned long long n, size_t max_terms = kMaxPolynomialTerms) const {
+        Polynomial result(T(1));
+        for (unsigned long long i = 0; i < n; ++i) {
+            result = result * *this;
+            if (result.size() > max_terms) {
+                return std::nullopt;
+            }
+        }
+        return result;
+    }
+
+    // Вычисление по схеме Горнера
+    T eval(const std::map<std::string, T>& context) const {
+        ValueBuilder builder{context};
+        return horner(builder);
+    }
+
+    // Обход схемы Горнера. Builder задаёт тип Result и операции
+    // constant(c), power(name, n), fma(a, b, c) = a * b + c и mul(a, b)
+    template<typename Builder>
+    typename Builder::Result horner(Builder& builder) const {
+        return horner_step(builder, horner_order(), 0, sorted_terms());
+    }
+
+    // Распознаёт многочлен в выражении; пустой результат, если это не многочлен
+    static std::optional<Polynomial> from_expression(const Expression<T>& expr,
+                                                     size_t max_terms = kMaxPolynomialTerms);
+
+    // Обратное преобразование в дерево выражения
+    Expression<T> to_expression() const {
+        if (terms_.empty()) {
+            return Expression<T>(T(0));
+        }
+        std::optional<Expression<T>> result;
+        for (const auto* entry : sorted_terms()) {
+            const Monomial& monomial = entry->first;
+            const T& coefficient = entry->second;
+            std::optional<Expression<T>> term;
+            if (coefficient != T(1) || monomial.empty()) {
+                term = Expression<T>(coefficient);
+            }
+            for (const auto& [name, power] : monomial) {
+                Expression<T> factor(name);
+                if (power != 1) {
+                    factor = factor ^ Expression<T>(T(power));
+                }
+                term = term ? *term * factor : factor;
+            }
+            result = result ? *result + *term : *term;
+        }
+        return *result;
+    }
+
+private:
+    // Одночлены в лексикографическом порядке — для детерминированного вывода
+    std::vector<const typename Terms::value_type*> sorted_terms() const {
+        std::vector<const typename Terms::value_type*> result;
+        for (const auto& term : terms_) {
+            result.push_back(&term);
+        }
+        std::sort(result.begin(), result.end(), [](const auto* a, const auto* b) { return a->first < b->first; });
+        return result;
+    }
+
+    // Добавляет коэффициент к одночлену, удаляя обнулившиеся слагаемые
+    void add_term(const Monomial& monomial, const T& coefficient) {
+        T& slot = terms_[monomial];
+        slot += coefficient;
+        if (slot == T(0)) {
+            terms_.erase(monomial);
+        }
+    }
+
+    // Порядок переменных для схемы Горнера: сначала входящие в большее число одночленов
+    std::vector<std::string> horner_order() const {
+        std::map<std::string, size_t> usage;
+        for (const auto& [monomial, coefficient] : terms_) {
+            for (const auto& [name, power] : monomial) {
+                ++usage[name];
+            }
+        }
+        std::vector<std::string> order;
+        for (const auto& [name, count] : usage) {
+            order.push_back(name);
+        }
+        std::stable_sort(order.begin(), order.end(), [&](const std::string& a, const std::string& b) {
+            return usage[a] > usage[b];
+        });
+        return order;
+    }
+
+    // Один уровень схемы Горнера: p = sum c_d(остальные переменные) * v^d по убыванию d
+    template<typename Builder>
+    static typename Builder::Result horner_step(Builder& builder, const std::vector<std::string>& order, size_t level,
+                                                const std::vector<const typename Terms::value_type*>& terms) {
+        if (terms.empty()) {
+            return builder.constant(T(0));
+        }
+        if (level == order.size()) {
+            return builder.constant(terms.front()->second); // Остался единственный свободный член
+        }
+        const std::string& name = order[level];
+        std::map<unsigned, std::vector<const typename Terms::value_type*>, std::greater<unsigned>> groups;
+        for (const auto* term : terms) {
+            auto iter = term->first.find(name);
+            groups[iter == term->first.end() ? 0 : iter->second].push_back(term);
+        }
+
+        auto group = groups.begin();
+        typename Builder::Result accumulator = horner_step(builder, order, level + 1, group->second);
+        unsigned previous = group->first;
+        for (++group; group != groups.end(); ++group) {
+            typename Builder::Result step = builder.power(name, previous - group->first);
+            accumulator = builder.fma(accumulator, step, horner_step(builder, order, level + 1, group->second));
+            previous = group->first;
+        }
+        if (previous > 0) {
+            accumulator = builder.mul(accumulator, builder.power(name, previous)); // Общий множитель v^d_min
+        }
+        return accumulator;
+    }
+
+    // Построитель схемы Горнера, сразу вычисляющий значение
+    struct ValueBuilder {
+        using Result = T;
+        const std::map<std::string, T>& context;
+
+        T constant(const T& value) { return value; }
+        T power(const std::string& name, unsigned n) {
+            auto iter = context.find(name);
+            if (iter == context.end()) {
+                throw std::runtime_error("Variable \"" + name + "\" not present in evaluation context");
+            }
+            return integer_power(iter->second, n);
+        }
+        T fma(const T& a, const T& b, const T& c) { return fused_multiply_add(a, b, c); }
+        T mul(const T& a, const T& b) { return a * b; }
+    };
+
+    Terms terms_;
+};
+
+// Рациональная функция: отношение двух многочленов
+template<typename T>
+class RationalFunction {
+public:
+    RationalFunction(Polynomial<T> numerator, Polynomial<T> denominator = Polynomial<T>(T(1)))
+        : RationalFunction(std::move(numerator), std::move(denominator), 1) {}
+
+    const Polynomial<T>& numerator() const { return numerator_; }
+    // Знаменатель хранится как основание и показатель: base()^power()
+    const Polynomial<T>& base() const { return base_; }
+    unsigned power() const { return power_; }
+    Polynomial<T> denominator() const { return *base_.pow(power_, std::numeric_limits<size_t>::max()); }
+    bool is_polynomial() const { return power_ == 0; }
+    size_t size() const { return std::max(numerator_.size(), base_.size()); }
+
+    // Арифметические операции. При общем основании знаменателя складываются показатели,
+    // иначе знаменатели перемножаются
+    RationalFunction operator+(const RationalFunction& that) const {
+        if (shares_base(that)) {
+            const Polynomial<T>& base = is_polynomial() ? that.base_ : base_;
+            unsigned power = std::max(power_, that.power_);
+            return RationalFunction(numerator_ * *base.pow(power - power_, std::numeric_limits<size_t>::max()) +
+                                        that.numerator_ * *base.pow(power - that.power_, std::numeric_limits<size_t>::max()),
+                                    base, power);
+        }
+        return RationalFunction(numerator_ * that.denominator() + that.numerator_ * denominator(),
+                                denominator() * that.denominator());
+    }
+    RationalFunction operator-(const RationalFunction& that) const {
+        return *this + RationalFunction(-that.numerator_, that.base_, that.power_);
+    }
+    RationalFunction operator*(const RationalFunction& that) const {
+        if (shares_base(that)) {
+            return RationalFunction(numerator_ * that.numerator_, is_polynomial() ? that.base_ : base_, power_ + that.power_);
+        }
+        return RationalFunction(numerator_ * that.numerator_, denominator() * that.denominator());
+    }
+    RationalFunction operator/(const RationalFunction& that) const {
+        if (that.numerator_.is_constant() && !that.numerator_.is_zero()) {
+            return *this * RationalFunction(that.denominator() * Polynomial<T>(T(1) / that.numerator_.constant()));
+        }
+        return *this * RationalFunction(that.denominator(), that.numerator_);
+    }
+
+    // Возведение в целую степень; пустой результат, если многочлены разрослись сверх max_terms
+    std::optional<RationalFunction> pow(long long n, size_t max_terms = kMaxPolynomialTerms) const {
+        unsigned long long magnitude = n < 0 ? -static_cast<unsigned long long>(n) : n;
+        auto numerator = numerator_.pow(magnitude, max_terms);
+        if (!numerator) {
+            return std::nullopt;
+        }
+        if (n >= 0) {
+            return RationalFunction(*numerator, base_, static_cast<unsigned>(power_ * magnitude));
+        }
+        auto denominator = base_.pow(power_ * magnitude, max_terms);
+        if (!denominator) {
+            return std::nullopt;
+        }
+        return RationalFunction(*denominator, *numerator, 1);
+    }
+
+    // Производная по правилу частного для p / q^k: (p' q - k p q') / q^(k + 1).
+    // Знаменатель растёт на одну степень основания за порядок, а не возводится в квадрат
+    RationalFunction diff(const std::string& variable) const {
+        if (is_polynomial()) {
+            return RationalFunction(numerator_.diff(variable));
+        }
+        return RationalFunction(numerator_.diff(variable) * base_ - numerator_ * base_.diff(variable) * Polynomial<T>(T(power_)),
+                                base_, power_ + 1);
+    }
+
+    // Вычисление по схеме Горнера с проверкой знаменателя
+    T eval(const std::map<std::string, T>& context) const {
+        if (is_polynomial()) {
+            return numerator_.eval(context);
+        }
+        T denominator = integer_power(base_.eval(context), power_);
+        if (denominator == T(0)) {
+            throw std::runtime_error("Division by zero");
+        }
+        return numerator_.eval(context) / denominator;
+    }
+
+    // Обратное преобразование в дерево выражения
+    Expression<T> to_expression() const {
+        if (is_polynomial()) {
+            return numerator_.to_expression();
+        }
+        if (power_ == 1) {
+            return numerator_.to_expression() / base_.to_expression();
+        }
+        return numerator_.to_expression() / (base_.to_expression() ^ Expression<T>(T(power_)));
+    }
+
+    // Распознаёт рациональную функцию в выражении; пустой результат, если это не так
+    static std::optional<RationalFunction> from_expression(const Expression<T>& expr,
+                                                           size_t max_terms = kMaxPolynomialTerms);
+
+private:
+    RationalFunction(Polynomial<T> numerator, Polynomial<T> base, unsigned power)
+        : numerator_(std::move(numerator)), base_(std::move(base)), power_(power) {
+        normalize();
+    }
+
+    // Знаменатели с общим основанием (многочлен — основание в нулевой степени)
+    bool shares_base(const RationalFunction& that) const {
+        return is_polynomial() || that.is_polynomial() || base_ == that.base_;
+    }
+
+    // Постоянный знаменатель переносится в коэффициенты числителя
+    void normalize() {
+        if (power_ > 0 && base_.is_constant() && !base_.is_zero()) {
+            T denominator = integer_power(base_.constant(), power_);
+            if (denominator != T(1)) {
+                numerator_ = numerator_ * Polynomial<T>(T(1) / denominator);
+            }
+            power_ = 0;
+        }
+        if (power_ == 0) {
+            base_ = Polynomial<T>(T(1));
+        }
+    }
+
+    Polynomial<T> numerator_, base_; // Числитель и основание знаменателя
+    unsigned power_;                  // Показатель знаменателя; 0 — многочлен
+};
+
+// Анализ подвыражений: для каждого узла дерева определяет, является ли он рациональной функцией.
+// Результаты запоминаются по id узла, поэтому анализ всего дерева линеен по числу узлов
+template<typename T>
+class RationalAnalysis {
+public:
+    explicit RationalAnalysis(size_t max_terms = kMaxPolynomialTerms) : max_terms_(max_terms) {}
+
+    const std::optional<RationalFunction<T>>& analyze(const Expression<T>& expr) {
+        auto iter = memo_.find(expr.id());
+        if (iter != memo_.end()) {
+            return iter->second;
+        }
+        std::optional<RationalFunction<T>> result = compute(expr);
+        if (result && result->size() > max_terms_) {
+            result.reset(); // Слишком большой многочлен выгоднее вычислять деревом
+        }
+        return memo_.emplace(expr.id(), std::move(result)).first->second;
+    }
+
+private:
+    using Kind = typename Expression<T>::Kind;
+
+    std::optional<RationalFunction<T>> compute(const Expression<T>& expr) {
+        switch (expr.kind()) {
+        case Kind::Value:
+            return RationalFunction<T>(Polynomial<T>(expr.value()));
+        case Kind::Variable:
+            return RationalFunction<T>(Polynomial<T>::variable(expr.name()));
+        default:
+            break;
+        }
+
+        std::vector<Expression<T>> operands = expr.operands();
+        std::vector<RationalFunction<T>> parts;
+        for (const Expression<T>& operand : operands) {
+            const auto& part = analyze(operand);
+            if (!part) {
+                return std::nullopt;
+            }
+            parts.push_back(*part);
+        }
+
+        switch (expr.kind()) {
+        case Kind::Add:
+            return parts[0] + parts[1];
+        case Kind::Sub:
+            return parts[0] - parts[1];
+        case Kind::Mul:
+            return parts[0] * parts[1];
+        case Kind::Div:
+            return parts[0] / parts[1];
+        case Kind::Pow: {
+            if (!parts[1].is_polynomial() || !parts[1].numerator().is_constant()) {
+                return std::nullopt; // Показатель зависит от переменных
+            }
+            T exponent = parts[1].numerator().constant();
+            if (parts[0].is_polynomial() && parts[0].numerator().is_constant()) {
+                return RationalFunction<T>(Polynomial<T>(fast_pow(parts[0].numerator().constant(), exponent)));
+            }
+            long long n;
+            if (!is_integer_exponent(exponent, n)) {
+                return std::nullopt;
+            }
+            return parts[0].pow(n, max_terms_);
+        }
+        default:
+            break;
+        }
+
+        // Функции от константы сворачиваются в константу
+        if (!parts[0].is_polynomial() || !parts[0].numerator().is_constant()) {
+            return std::nullopt;
+        }
+        T argument = parts[0].numerator().constant();
+        switch (expr.kind()) {
+        case Kind::Sin:
+            return RationalFunction<T>(Polynomial<T>(std::sin(argument)));
+        case Kind::Cos:
+            return RationalFunction<T>(Polynomial<T>(std::cos(argument)));
+        case Kind::Ln:
+            return RationalFunction<T>(Polynomial<T>(std::log(argument)));
+        case Kind::Exp:
+            return RationalFunction<T>(Polynomial<T>(std::exp(argument)));
+        default:
+            return std::nullopt;
+        }
+    }
+
+    size_t max_terms_;
+    std::map<const void*, std::optional<RationalFunction<T>>> memo_;
+};
+
+template<typename T>
+std::optional<RationalFunction<T>> RationalFunction<T>::from_expression(const Expression<T>& expr, size_t max_terms) {
+    return RationalAnalysis<T>(max_terms).analyze(expr);
+}
+
+template<typename T>
+std::optional<Polynomial<T>> Polynomial<T>::from_expression(const Expression<T>& expr, size_t max_terms) {
+    auto rational = RationalFunction<T>::from_expression(expr, max_terms);
+    if (!rational || !rational->is_polynomial()) {
+        return std::nullopt;
+    }
+    return rational->numerator();
+}
+
+// Производная порядка order. Полиномиальные и рациональные выражения дифференцируются в нормальной форме
+// и остаются компактными; остальные — обычным diff с упрощением
+template<typename T>
+Expression<T> normal_form_diff(const Expression<T>& expr, const std::string& variable, unsigned order = 1) {
+    if (auto rational = RationalFunction<T>::from_expression(expr)) {
+        bool compact = true;
+        for (unsigned i = 0; i < order && compact; ++i) {
+            *rational = rational->diff(variable);
+            compact = rational->size() <= kMaxPolynomialTerms; // Разросшаяся форма бросается сразу
+        }
+        if (compact) {
+            return rational->to_expression();
+        }
+    }
+    Expression<T> result = expr;
+    for (unsigned i = 0; i < order; ++i) {
+        result = result.diff(variable).simplify();
+    }
+    return result;
+}
+
+#endif // POLYNOMIAL_HPP
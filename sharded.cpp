@@ -0,0 +1,274 @@
+#include "sharded.hpp"
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+
+namespace {
+
+using Instruction = CompiledExpression<double>::Instruction;
+static_assert(std::is_trivially_copyable_v<Instruction>, "Instructions are copied into shared memory as bytes");
+
+constexpr size_t kMaxWorkers = 1024;
+constexpr size_t kErrorLength = 256;
+
+// Выравнивание смещений в сегменте по строке кэша
+size_t align(size_t offset) {
+    return (offset + 63) / 64 * 64;
+}
+
+// Разбирает список процессоров вида "0-3,8,10-11"
+std::vector<int> parse_cpu_list(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream stream(list);
+    std::string range;
+    while (std::getline(stream, range, ',')) {
+        if (range.empty() || range == "\n") {
+            continue;
+        }
+        size_t dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+} // namespace
+
+// Заголовок сегмента; за ним следуют инструкции, слоты выходов, состояния процессов и столбцы
+struct SharedMemoryEvaluator::Header {
+    size_t instruction_count;
+    size_t variable_count;
+    size_t slot_count;
+    unsigned result_slot;
+    size_t points;
+    size_t instructions_offset;
+    size_t workers_offset;
+    size_t columns_offset;
+    size_t output_offset;
+};
+
+// Состояние процесса-исполнителя, которое он сам заполняет в сегменте
+struct SharedMemoryEvaluator::WorkerSlot {
+    size_t begin, end; // Часть точек, заданная родителем
+    std::atomic<int> done;
+    int ok;
+    double seconds;
+    char error[kErrorLength];
+};
+
+SharedMemoryEvaluator::SharedMemoryEvaluator(const CompiledExpression<double>& program, size_t points)
+    : variables_(program.variables()), points_(points) {
+    static std::atomic<unsigned> counter{0};
+    name_ = "/differentiator-" + std::to_string(getpid()) + "-" + std::to_string(counter++);
+
+    size_t instructions_offset = align(sizeof(Header));
+    size_t workers_offset = align(instructions_offset + program.instructions().size() * sizeof(Instruction));
+    size_t columns_offset = align(workers_offset + kMaxWorkers * sizeof(WorkerSlot));
+    size_t output_offset = align(columns_offset + variables_.size() * points * sizeof(double));
+    size_ = align(output_offset + points * sizeof(double));
+
+    int fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        throw std::runtime_error("shm_open failed: " + std::string(std::strerror(errno)));
+    }
+    if (ftruncate(fd, static_cast<off_t>(size_)) != 0) {
+        int error = errno;
+        close(fd);
+        shm_unlink(name_.c_str());
+        throw std::runtime_error("ftruncate failed: " + std::string(std::strerror(error)));
+    }
+    memory_ = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory_ == MAP_FAILED) {
+        memory_ = nullptr;
+        shm_unlink(name_.c_str());
+        throw std::runtime_error("mmap failed: " + std::string(std::strerror(errno)));
+    }
+
+    Header* head = header();
+    head->instruction_count = program.instructions().size();
+    head->variable_count = variables_.size();
+    head->slot_count = program.slots();
+    head->result_slot = program.result_slots().front();
+    head->points = points;
+    head->instructions_offset = instructions_offset;
+    head->workers_offset = workers_offset;
+    head->columns_offset = columns_offset;
+    head->output_offset = output_offset;
+    std::memcpy(static_cast<char*>(memory_) + instructions_offset, program.instructions().data(),
+                program.instructions().size() * sizeof(Instruction));
+}
+
+SharedMemoryEvaluator::~SharedMemoryEvaluator() {
+    if (memory_) {
+        munmap(memory_, size_);
+        shm_unlink(name_.c_str());
+    }
+}
+
+SharedMemoryEvaluator::Header* SharedMemoryEvaluator::header() const {
+    return static_cast<Header*>(memory_);
+}
+
+SharedMemoryEvaluator::WorkerSlot* SharedMemoryEvaluator::worker_slot(size_t index) const {
+    return reinterpret_cast<WorkerSlot*>(static_cast<char*>(memory_) + header()->workers_offset) + index;
+}
+
+double* SharedMemoryEvaluator::column(size_t index) {
+    if (index >= variables_.size()) {
+        throw std::out_of_range("Column index out of range");
+    }
+    return reinterpret_cast<double*>(static_cast<char*>(memory_) + header()->columns_offset) + index * points_;
+}
+
+double* SharedMemoryEvaluator::output() {
+    return reinterpret_cast<double*>(static_cast<char*>(memory_) + header()->output_offset);
+}
+
+std::vector<std::vector<int>> SharedMemoryEvaluator::numa_nodes() {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+
+    std::vector<std::vector<int>> nodes;
+    for (int node = 0;; ++node) {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!file) {
+            break;
+        }
+        std::string list;
+        std::getline(file, list);
+        std::vector<int> cpus;
+        for (int cpu : parse_cpu_list(list)) {
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+                cpus.push_back(cpu); // Только процессоры, разрешённые текущему процессу
+            }
+        }
+        if (!cpus.empty()) {
+            nodes.push_back(cpus);
+        }
+    }
+    if (nodes.empty()) {
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                cpus.push_back(cpu);
+            }
+        }
+        nodes.push_back(cpus);
+    }
+    return nodes;
+}
+
+ShardedReport SharedMemoryEvaluator::run(size_t workers) {
+    if (workers == 0 || workers > kMaxWorkers) {
+        throw std::invalid_argument("Worker count must be between 1 and " + std::to_string(kMaxWorkers));
+    }
+    auto started = std::chrono::steady_clock::now();
+    std::vector<std::vector<int>> nodes = numa_nodes();
+
+    // Границы частей кратны размеру блока, чтобы процессы не делили строки кэша выходного столбца
+    const size_t block = CompiledExpression<double>::kBlockSize;
+    size_t blocks = (points_ + block - 1) / block;
+    ShardedReport report;
+    std::vector<pid_t> pids;
+    for (size_t w = 0; w < workers; ++w) {
+        ShardStatus shard;
+        shard.begin = std::min(points_, blocks * w / workers * block);
+        shard.end = std::min(points_, blocks * (w + 1) / workers * block);
+        shard.node = static_cast<int>(w % nodes.size());
+        report.shards.push_back(shard);
+
+        WorkerSlot* slot = worker_slot(w);
+        slot->begin = shard.begin;
+        slot->end = shard.end;
+        slot->done.store(0);
+        slot->ok = 0;
+        slot->seconds = 0;
+        slot->error[0] = '\0';
+    }
+
+    std::fflush(nullptr); // Буферы вывода не должны продублироваться в дочерних процессах
+    for (size_t w = 0; w < workers; ++w) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            run_worker(header(), w, nodes[report.shards[w].node]);
+            _exit(worker_slot(w)->ok ? 0 : 1);
+        }
+        if (pid < 0) {
+            report.shards[w].error = "fork failed: " + std::string(std::strerror(errno));
+        }
+        pids.push_back(pid);
+    }
+
+    for (size_t w = 0; w < workers; ++w) {
+        if (pids[w] < 0) {
+            continue;
+        }
+        int status = 0;
+        waitpid(pids[w], &status, 0);
+        WorkerSlot* slot = worker_slot(w);
+        ShardStatus& shard = report.shards[w];
+        shard.seconds = slot->seconds;
+        if (WIFSIGNALED(status)) {
+            shard.error = "worker terminated by signal " + std::to_string(WTERMSIG(status));
+        } else if (!slot->done.load() || !slot->ok) {
+            shard.error = slot->error[0] ? slot->error : "worker exited with status " + std::to_string(WEXITSTATUS(status));
+        } else {
+            shard.ok = true;
+        }
+    }
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    return report;
+}
+
+void SharedMemoryEvaluator::run_worker(Header* head, size_t index, const std::vector<int>& cpus) {
+    char* base = reinterpret_cast<char*>(head);
+    WorkerSlot* slot = reinterpret_cast<WorkerSlot*>(base + head->workers_offset) + index;
+    try {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus) {
+            CPU_SET(cpu, &set);
+        }
+        sched_setaffinity(0, sizeof(set), &set); // Память выходного столбца выделяется на узле процесса при первой записи
+
+        // Программа читается из сегмента, а не из памяти родителя
+        const Instruction* instructions = reinterpret_cast<const Instruction*>(base + head->instructions_offset);
+        CompiledExpression<double> program(std::vector<std::string>(head->variable_count),
+                                           std::vector<Instruction>(instructions, instructions + head->instruction_count),
+                                           std::vector<unsigned>{head->result_slot}, head->slot_count);
+
+        // Вычисление своей части прямо в сегменте
+        std::vector<const double*> columns(head->variable_count);
+        for (size_t v = 0; v < columns.size(); ++v) {
+            columns[v] = reinterpret_cast<const double*>(base + head->columns_offset) + v * head->points + slot->begin;
+        }
+        double* output = reinterpret_cast<double*>(base + head->output_offset) + slot->begin;
+        auto started = std::chrono::steady_clock::now();
+        program.eval_batch(columns, output, slot->end - slot->begin);
+        slot->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        slot->ok = 1;
+    } catch (const std::exception& e) {
+        std::strncpy(slot->error, e.what(), kErrorLength - 1);
+        slot->error[kErrorLength - 1] = '\0';
+        slot->ok = 0;
+    }
+    slot->done.store(1);
+}
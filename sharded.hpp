@@ -0,0 +1,73 @@
+#ifndef SHARDED_HPP
+#define SHARDED_HPP
+
+#include "compiled.hpp"
+#include <string>
+#include <vector>
+
+// Итог работы одного процесса-исполнителя
+struct ShardStatus {
+    size_t begin = 0, end = 0; // Диапазон точек [begin, end)
+    int node = 0;              // Узел NUMA, к процессорам которого привязан процесс
+    double seconds = 0;        // Время вычисления внутри процесса
+    bool ok = false;
+    std::string error;         // Текст ошибки, если ok == false
+};
+
+// Итог распределённого вычисления
+struct ShardedReport {
+    std::vector<ShardStatus> shards;
+    double seconds = 0; // Полное время от запуска до завершения всех процессов
+    bool ok() const {
+        for (const ShardStatus& shard : shards) {
+            if (!shard.ok) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// Вычисление в нескольких процессах над разделяемой памятью POSIX.
+// Программа, входные столбцы и выходной столбец лежат в одном сегменте shm_open;
+// дочерние процессы (fork) привязываются к узлам NUMA и вычисляют свою часть точек
+// прямо в сегменте, без копирования данных. Сбой одного процесса не затрагивает остальные
+class SharedMemoryEvaluator {
+public:
+    // Размещает программу и столбцы для points точек в разделяемой памяти (первый выход программы)
+    SharedMemoryEvaluator(const CompiledExpression<double>& program, size_t points);
+    ~SharedMemoryEvaluator();
+
+    SharedMemoryEvaluator(const SharedMemoryEvaluator&) = delete;
+    SharedMemoryEvaluator& operator=(const SharedMemoryEvaluator&) = delete;
+
+    const std::vector<std::string>& variables() const { return variables_; }
+    size_t points() const { return points_; }
+    const std::string& name() const { return name_; } // Имя сегмента для подключения других процессов
+
+    // Входной столбец переменной variables()[index] и выходной столбец в разделяемой памяти
+    double* column(size_t index);
+    double* output();
+
+    // Запускает workers процессов и ждёт их завершения
+    ShardedReport run(size_t workers);
+
+    // Процессоры каждого узла NUMA; если узлы не видны, один узел со всеми доступными процессорами
+    static std::vector<std::vector<int>> numa_nodes();
+
+private:
+    struct Header;
+    struct WorkerSlot;
+
+    Header* header() const;
+    WorkerSlot* worker_slot(size_t index) const;
+    static void run_worker(Header* header, size_t index, const std::vector<int>& cpus);
+
+    std::vector<std::string> variables_;
+    size_t points_;
+    std::string name_;
+    void* memory_ = nullptr;
+    size_t size_ = 0;
+};
+
+#endif // SHARDED_HPP
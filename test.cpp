@@ -3,8 +3,21 @@
 
 #include "expression.hpp"
 #include "parser.hpp"
+#include "polynomial.hpp"
+#include "compiled.hpp"
+#include "jacobian.hpp"
+#include "mixed.hpp"
+#include "cache.hpp"
+#include "pipeline.hpp"
+#include "sharded.hpp"
+#include "columnar.hpp"
+#include "egraph.hpp"
+#include <cstdio>
+#include <fstream>
+#include <mutex>
 #include <iostream>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 
 // Тест для проверки сложения
@@ -82,7 +95,7 @@ void test_to_string() {
 void test_differentiation_addition() {
     Expression<double> expr = "x"_var + 2.0_val;
     Expression<double> derivative = expr.diff("x");
-    assert(derivative.to_string() == "(1 + 0)");
+    assert(derivative.to_string() == "1");
     std::cout << "test_differentiation_addition: OK\n";
 }
 
@@ -113,6 +126,489 @@ void test_differentiation_power() {
     std::cout << "test_differentiation_power: OK\n";
 }
 
+// Тест для проверки распознавания многочленов и схемы Горнера
+void test_polynomial_horner() {
+    Expression<double> expr = Expression<double>::from_string("(x + 1) ^ 3 * y - 2 * x / 4");
+    auto polynomial = Polynomial<double>::from_expression(expr);
+    assert(polynomial && polynomial->size() == 5);
+    std::map<std::string, double> context = {{"x", 1.5}, {"y", -2.0}};
+    assert(std::abs(polynomial->eval(context) - expr.eval(context)) < 1e-9);
+    assert(std::abs(polynomial->to_expression().eval(context) - expr.eval(context)) < 1e-9);
+
+    auto rational = RationalFunction<double>::from_expression(Expression<double>::from_string("1 / x + y ^ 2"));
+    assert(rational && !rational->is_polynomial());
+    assert(!RationalFunction<double>::from_expression(Expression<double>::from_string("sin(x) * x")));
+    std::cout << "test_polynomial_horner: OK\n";
+}
+
+// Тест для проверки скомпилированного выражения
+void test_compiled_eval() {
+    Expression<double> expr = Expression<double>::from_string("sin(x ^ 2 + 3 * x * y) / (y ^ 5 - 1) + exp(x) ^ 2");
+    CompiledExpression<double> compiled(expr);
+    CompiledExpression<double> plain(expr, false);
+    std::map<std::string, double> context = {{"x", 0.7}, {"y", 2.0}};
+    assert(std::abs(compiled.eval(context) - expr.eval(context)) < 1e-9);
+    assert(std::abs(plain.eval(context) - expr.eval(context)) < 1e-9);
+
+    std::vector<double> xs(1000), ys(1000), out(1000);
+    for (size_t i = 0; i < xs.size(); ++i) {
+        xs[i] = 0.001 * i;
+        ys[i] = 2.0 + 0.002 * i;
+    }
+    std::vector<const double*> columns(2);
+    columns[compiled.variables()[0] == "x" ? 0 : 1] = xs.data();
+    columns[compiled.variables()[0] == "x" ? 1 : 0] = ys.data();
+    compiled.eval_batch(columns, out.data(), out.size());
+    for (size_t i = 0; i < xs.size(); ++i) {
+        assert(std::abs(out[i] - expr.eval({{"x", xs[i]}, {"y", ys[i]}})) < 1e-9 * (1 + std::abs(out[i])));
+    }
+
+    bool thrown = false;
+    try {
+        CompiledExpression<double>(Expression<double>::from_string("1 / (x - 1)")).eval({{"x", 1.0}});
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+    std::cout << "test_compiled_eval: OK\n";
+}
+
+// Тест для проверки разреженной матрицы Якоби с раскраской столбцов
+void test_sparse_jacobian() {
+    const size_t n = 20;
+    std::vector<Expression<double>> outputs;
+    std::map<std::string, double> context;
+    for (size_t i = 0; i < n; ++i) {
+        Expression<double> left("v" + std::to_string(i == 0 ? n - 1 : i - 1));
+        Expression<double> center("v" + std::to_string(i));
+        Expression<double> right("v" + std::to_string((i + 1) % n));
+        outputs.push_back(left * center + right.sin() + (center ^ 3.0_val));
+        context["v" + std::to_string(i)] = 0.1 * (i + 1);
+    }
+    ExpressionSystem<double> system(outputs);
+    assert(system.nonzeros() == 3 * n);
+    assert(system.color_count() <= 4);
+
+    CsrMatrix<double> jacobian = system.jacobian(context);
+    CsrMatrix<Expression<double>> symbolic = system.symbolic_jacobian();
+    assert(jacobian.row_ptr.size() == n + 1 && jacobian.values.size() == 3 * n);
+    for (size_t row = 0; row < n; ++row) {
+        for (size_t k = jacobian.row_ptr[row]; k < jacobian.row_ptr[row + 1]; ++k) {
+            const std::string& name = system.variables()[jacobian.col_index[k]];
+            double expected = outputs[row].diff(name).eval(context);
+            assert(std::abs(jacobian.values[k] - expected) < 1e-9);
+            assert(std::abs(symbolic.values[k].eval(context) - expected) < 1e-9);
+        }
+    }
+    std::cout << "test_sparse_jacobian: OK\n";
+}
+
+// Тест для проверки вычислений в float и со смешанной точностью
+void test_mixed_precision() {
+    Expression<float> single = Expression<float>::from_string("x ^ 2 + 2 * x * y");
+    assert(std::abs(single.eval({{"x", 1.5f}, {"y", 2.0f}}) - 8.25f) < 1e-5f);
+    assert((3.0_val_f * "x"_var_f).eval({{"x", 2.0f}}) == 6.0f);
+
+    // Вблизи x = y вычитание теряет точность, и такие точки должны пересчитываться в double
+    Expression<double> expr = Expression<double>::from_string("(x - y) * 1000 + sin(x)");
+    MixedPrecisionExpression mixed(expr, 1e-4);
+    std::vector<double> xs = {0.5, 1.0, 2.0, 1.0000001}, ys = {0.1, 0.2, 0.3, 1.0}, out(4), errors(4);
+    std::vector<unsigned char> recomputed(4);
+    std::vector<const double*> columns(2);
+    columns[mixed.variables()[0] == "x" ? 0 : 1] = xs.data();
+    columns[mixed.variables()[0] == "x" ? 1 : 0] = ys.data();
+    MixedPrecisionExpression::Report report = mixed.eval_batch(columns, out.data(), 4, errors.data(), recomputed.data());
+    assert(report.points == 4 && report.recomputed >= 1 && recomputed[3] == 1);
+    for (size_t i = 0; i < out.size(); ++i) {
+        double exact = expr.eval({{"x", xs[i]}, {"y", ys[i]}});
+        assert(std::abs(out[i] - exact) <= 1e-4 * std::abs(exact) + 1e-12);
+        assert(recomputed[i] || std::abs(out[i] - exact) <= errors[i] + 1e-7 * std::abs(exact));
+    }
+
+    // Делитель, обнуляющийся в float, не ломает пакет: точка пересчитывается в double
+    MixedPrecisionExpression reciprocal(Expression<double>::from_string("1 / (x - y)"));
+    xs = {1.00000001, 2.0};
+    ys = {1.0, 1.0};
+    columns[reciprocal.variables()[0] == "x" ? 0 : 1] = xs.data();
+    columns[reciprocal.variables()[0] == "x" ? 1 : 0] = ys.data();
+    report = reciprocal.eval_batch(columns, out.data(), 2, nullptr, recomputed.data());
+    assert(recomputed[0] == 1 && std::abs(out[0] - 1e8) < 1.0 && out[1] == 1.0);
+    xs[0] = 1.0; // Ноль и в double — исключение
+    bool thrown = false;
+    try {
+        reciprocal.eval_batch(columns, out.data(), 2);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // Дробная степень положительного основания оценивается без пересчёта
+    MixedPrecisionExpression root(Expression<double>::from_string("x ^ 0.5 * y"), 1e-4);
+    xs = {0.5, 1.0, 2.0, 4.0};
+    ys = {0.1, 0.2, 0.3, 1.0};
+    columns[root.variables()[0] == "x" ? 0 : 1] = xs.data();
+    columns[root.variables()[0] == "x" ? 1 : 0] = ys.data();
+    report = root.eval_batch(columns, out.data(), 4, errors.data());
+    assert(report.recomputed == 0);
+    for (size_t i = 0; i < out.size(); ++i) {
+        assert(std::abs(out[i] - std::sqrt(xs[i]) * ys[i]) <= errors[i]);
+    }
+    std::cout << "test_mixed_precision: OK\n";
+}
+
+// Тест для проверки, что без пересчётов смешанная точность быстрее вычисления в double.
+// Прогоны чередуются, сравниваются лучшие времена — так меньше влияет шум
+void test_mixed_precision_speed() {
+    const size_t points = 200000;
+    Expression<double> expr = Expression<double>::from_string("sin(x) * cos(y) + x * y");
+    CompiledExpression<double> precise(expr);
+    MixedPrecisionExpression mixed(expr, 1e-3);
+    std::vector<double> xs(points), ys(points), out(points);
+    for (size_t i = 0; i < points; ++i) {
+        xs[i] = 0.5 + 1e-6 * i;
+        ys[i] = 1.0 + 5e-7 * i;
+    }
+    std::vector<const double*> columns(2);
+    columns[mixed.variables()[0] == "x" ? 0 : 1] = xs.data();
+    columns[mixed.variables()[0] == "x" ? 1 : 0] = ys.data();
+    auto elapsed = [](auto run) {
+        auto begin = std::chrono::steady_clock::now();
+        run();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    };
+    double double_best = 1e9, mixed_best = 1e9;
+    MixedPrecisionExpression::Report report;
+    for (int run = 0; run < 15; ++run) {
+        double_best = std::min(double_best, elapsed([&] { precise.eval_batch(columns, out.data(), points); }));
+        mixed_best = std::min(mixed_best, elapsed([&] { report = mixed.eval_batch(columns, out.data(), points); }));
+    }
+    assert(report.recomputed == 0);
+    assert(mixed_best < double_best);
+    std::cout << "test_mixed_precision_speed: OK\n";
+}
+
+// Тест для проверки LRU-кэша формул
+void test_expression_cache() {
+    ExpressionCache cache(2);
+    auto first = cache.get("x * x + y", {"x"});
+    auto again = cache.get("x*x+y", {"x", "x"});
+    assert(first == again);
+    assert(std::abs(first->compiled_derivatives.at("x").eval({{"x", 3.0}, {"y", 1.0}}) - 6.0) < 1e-12);
+    assert(first->derivatives.at("x").eval({{"x", 3.0}, {"y", 1.0}}) == 6.0);
+
+    cache.get("x * x + y", {"y"}); // Другой набор переменных — другой ключ
+    cache.get("sin(x)");           // Вытесняет самую давнюю запись
+    ExpressionCache::Stats stats = cache.stats();
+    assert(stats.hits == 1 && stats.misses == 3 && stats.evictions == 1 && stats.size == 2);
+    assert(cache.get("x*x+y", {"x"}) != first);
+    std::cout << "test_expression_cache: OK\n";
+}
+
+// Тест для проверки конвейера обработки потока формул
+void test_formula_pipeline() {
+    std::mutex mutex;
+    std::map<size_t, FormulaResult> results;
+    FormulaPipeline::Options options;
+    options.parse_workers = 2;
+    options.eval_workers = 2;
+    options.queue_capacity = 4; // Маленькие очереди проверяют обратное давление
+    {
+        FormulaPipeline pipeline(options, [&](FormulaResult&& result) {
+            std::lock_guard<std::mutex> lock(mutex);
+            results[result.id] = std::move(result);
+        });
+        for (size_t i = 0; i < 100; ++i) {
+            FormulaJob job;
+            job.id = i;
+            job.source = i == 50 ? "x + sqrt(y)" : "x ^ " + std::to_string(i % 5 + 1) + " * y";
+            job.diff_variables = {"x"};
+            if (i % 2 == 0) {
+                job.diff_variables.push_back("x"); // Повтор переменной не удваивает производные
+            }
+            job.points = {{{"x", 2.0}, {"y", 3.0}}};
+            pipeline.submit(std::move(job));
+        }
+        pipeline.finish();
+        for (const auto& stage : pipeline.metrics()) {
+            assert(stage.processed == 100);
+        }
+    }
+    assert(results.size() == 100);
+    assert(!results[50].error.empty());
+    for (size_t i = 0; i < 100; ++i) {
+        if (i == 50) {
+            continue;
+        }
+        double n = i % 5 + 1;
+        assert(results[i].error.empty());
+        assert(results[i].values.size() == 1 && results[i].derivatives["x"].size() == 1);
+        assert(std::abs(results[i].values[0] - std::pow(2.0, n) * 3.0) < 1e-9);
+        assert(std::abs(results[i].derivatives["x"][0] - n * std::pow(2.0, n - 1) * 3.0) < 1e-9);
+    }
+    std::cout << "test_formula_pipeline: OK\n";
+}
+
+// Тест для проверки распределения слотов скомпилированного выражения
+void test_compiled_slots() {
+    Expression<double> expr = Expression<double>::from_string("sin(x * y) * exp(x ^ 2 + y) / (1 + x * x * y) + ln(x + y) * cos(x)");
+    Expression<double> derivative = expr.diff("x").diff("y").diff("x");
+    CompiledExpression<double> compiled(derivative);
+    assert(compiled.slots() * 4 < compiled.instructions().size());
+
+    std::map<std::string, double> context = {{"x", 0.7}, {"y", 1.3}};
+    double expected = derivative.eval(context);
+    assert(std::abs(compiled.eval(context) - expected) < 1e-9 * std::abs(expected));
+    for (const auto& ins : compiled.instructions()) {
+        assert(ins.dst < compiled.slots());
+    }
+
+    std::vector<double> tangents;
+    CompiledExpression<double> outputs(std::vector<Expression<double>>{expr, derivative});
+    std::vector<double> values = outputs.eval_directional(context, {1.0, 0.0}, 1, tangents);
+    assert(std::abs(values[1] - expected) < 1e-9 * std::abs(expected));
+    double slope = expr.diff(outputs.variables()[0]).eval(context);
+    assert(std::abs(tangents[0] - slope) < 1e-9 * (1 + std::abs(slope)));
+
+    // Переменных больше, чем слотов: Якобиан и оценка погрешности не выходят за рабочую память
+    Expression<double> sum = Expression<double>("v0");
+    std::map<std::string, double> point = {{"v0", 0.5}};
+    for (int i = 1; i < 10; ++i) {
+        std::string name = "v" + std::to_string(i);
+        sum = sum + Expression<double>(name);
+        point[name] = 0.5 * i;
+    }
+    CompiledExpression<double> wide(sum);
+    assert(wide.slots() < wide.variables().size());
+    CsrMatrix<double> jacobian = ExpressionSystem<double>({sum}).jacobian(point);
+    assert(jacobian.values == std::vector<double>(10, 1.0));
+    std::vector<std::vector<double>> inputs(wide.variables().size(), std::vector<double>(3, 0.5));
+    std::vector<const double*> columns;
+    for (const auto& column : inputs) {
+        columns.push_back(column.data());
+    }
+    std::vector<double> out(3), errors(3);
+    wide.eval_batch_with_error(columns, out.data(), errors.data(), 3);
+    assert(out[0] == 5.0 && errors[0] < 1e-12);
+    std::cout << "test_compiled_slots: OK\n";
+}
+
+// Тест для проверки вычисления в нескольких процессах над разделяемой памятью
+void test_sharded_eval() {
+    Expression<double> expr = Expression<double>::from_string("1 / (x - 1) + y * sin(x)");
+    const size_t points = 10000;
+    SharedMemoryEvaluator evaluator(CompiledExpression<double>(expr), points);
+    for (size_t v = 0; v < evaluator.variables().size(); ++v) {
+        double* column = evaluator.column(v);
+        for (size_t i = 0; i < points; ++i) {
+            column[i] = evaluator.variables()[v] == "x" ? 2.0 + 0.001 * i : 0.5;
+        }
+    }
+    ShardedReport report = evaluator.run(3);
+    assert(report.ok() && report.shards.size() == 3 && report.shards.back().end == points);
+    for (size_t i = 0; i < points; i += 97) {
+        double x = 2.0 + 0.001 * i;
+        assert(std::abs(evaluator.output()[i] - expr.eval({{"x", x}, {"y", 0.5}})) < 1e-12);
+    }
+
+    // Деление на ноль в одной части не мешает остальным
+    size_t x_index = evaluator.variables()[0] == "x" ? 0 : 1;
+    evaluator.column(x_index)[points - 1] = 1.0;
+    report = evaluator.run(2);
+    assert(!report.ok() && report.shards[0].ok && !report.shards[1].ok);
+    assert(report.shards[1].error == "Division by zero");
+    std::cout << "test_sharded_eval: OK\n";
+}
+
+// Тест для проверки дифференцирования в полиномиальной нормальной форме
+void test_polynomial_diff() {
+    Expression<double> expr = Expression<double>::from_string("(x + y) ^ 3 * x - 4 * x ^ 2 / y");
+    std::map<std::string, double> context = {{"x", 1.5}, {"y", 0.5}};
+    auto rational = RationalFunction<double>::from_expression(expr);
+    assert(rational && !rational->is_polynomial());
+    assert(std::abs(rational->diff("x").eval(context) - expr.diff("x").eval(context)) < 1e-9);
+
+    // Производные высоких порядков остаются компактными и не содержат ln
+    Expression<double> third = normal_form_diff(expr, "x", 3);
+    Expression<double> tree = expr.diff("x").diff("x").diff("x");
+    assert(std::abs(third.eval(context) - tree.eval(context)) < 1e-9);
+    assert(third.to_string().size() * 4 < tree.to_string().size());
+    Expression<double> product = Expression<double>::from_string("(x + y) ^ 3 * x");
+    Polynomial<double> polynomial = *Polynomial<double>::from_expression(product);
+    assert(polynomial.diff("y").size() == 3);
+    assert(std::abs(polynomial.diff("y").eval(context) - product.diff("y").eval(context)) < 1e-9);
+
+    // Постоянный показатель дифференцируется по степенному правилу
+    Expression<double> cube = "x"_var ^ 3.0_val;
+    assert(cube.diff("x").to_string() == "((3 * (x ^ 2)) * 1)");
+    assert(cube.diff("x").eval({{"x", 0.0}}) == 0.0);
+    // Нулевой показатель даёт нулевую производную и там, где основание обращается в ноль
+    assert(("x"_var ^ 0.0_val).diff("x").eval({{"x", 0.0}}) == 0.0);
+    assert((("x"_var - "x"_var) ^ 0.0_val).diff("x").eval({{"x", 1.0}}) == 0.0);
+
+    // Знаменатель растёт на одну степень за порядок: q^7 для шестой производной, а не q^64
+    Expression<double> reciprocal = Expression<double>::from_string("1 / (1 + x + y)");
+    auto sixth = RationalFunction<double>::from_expression(reciprocal);
+    for (int i = 0; i < 6; ++i) {
+        *sixth = sixth->diff("x");
+    }
+    assert(sixth->power() == 7 && sixth->base().size() == 3 && sixth->numerator().size() == 1);
+    assert(std::abs(sixth->eval(context) - 720.0 / std::pow(3.0, 7)) < 1e-9);
+    assert(normal_form_diff(reciprocal, "x", 6).to_string().size() < 40);
+    std::cout << "test_polynomial_diff: OK\n";
+}
+
+// Тест для проверки пакетного вычисления над столбцами в файлах
+void test_columnar_batch() {
+    const size_t points = 5000;
+    std::vector<double> xs(points);
+    std::vector<float> ys(points);
+    for (size_t i = 0; i < points; ++i) {
+        xs[i] = 0.01 * i;
+        ys[i] = 1.0f + 0.5f * (i % 7);
+    }
+    // Минимальный .npy версии 1 с float32
+    auto write_npy = [](const std::string& path, const std::string& shape, const std::vector<float>& values) {
+        std::string dict = "{'descr': '<f4', 'fortran_order': False, 'shape': " + shape + ", }";
+        dict.append((10 + dict.size() + 1 + 63) / 64 * 64 - 10 - dict.size() - 1, ' ');
+        dict += '\n';
+        std::ofstream npy(path, std::ios::binary);
+        npy.write("\x93NUMPY\x01\x00", 8);
+        npy.put(static_cast<char>(dict.size() & 0xff)).put(static_cast<char>(dict.size() >> 8));
+        npy << dict;
+        npy.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(float));
+    };
+    {
+        std::ofstream raw("test_column_x.bin", std::ios::binary);
+        raw.write(reinterpret_cast<const char*>(xs.data()), xs.size() * sizeof(double));
+    }
+    write_npy("test_column_y.npy", "(" + std::to_string(points) + ",)", ys);
+
+    // Двумерные массивы и несовпадение объявленной длины с данными отвергаются
+    std::vector<float> small(22, 1.0f);
+    for (const char* shape : {"(2, 11)", "(2, 1, 11)", "(21,)", "(23,)", "()", "(2,,1)"}) {
+        write_npy("test_column_bad.npy", shape, small);
+        bool thrown = false;
+        try {
+            MappedColumn column("test_column_bad.npy");
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+    write_npy("test_column_bad.npy", "(22, 1)", small);
+    assert(MappedColumn("test_column_bad.npy").size() == 22);
+    // Обрезанный заголовок версии 2 (длина занимает байты 8-11) и неизвестная версия 4 с корректным словарём
+    std::string dict = "{'descr': '<f4', 'fortran_order': False, 'shape': (0,), }";
+    dict.append(128 - 12 - dict.size() - 1, ' ');
+    dict += '\n';
+    for (const std::string& contents : {std::string("\x93NUMPY\x02\x00\x10\x00\x00", 11),
+                                        std::string("\x93NUMPY\x04\x00", 8) + char(dict.size()) + std::string(3, '\0') + dict}) {
+        std::ofstream("test_column_bad.npy", std::ios::binary) << contents;
+        bool thrown = false;
+        try {
+            MappedColumn column("test_column_bad.npy");
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+    std::remove("test_column_bad.npy");
+
+    Expression<double> expr = Expression<double>::from_string("x * y + sin(x)");
+    ColumnarBatch batch;
+    batch.bind("x", "test_column_x.bin");
+    batch.bind("y", "test_column_y.npy");
+    ColumnarBatch::Report report = batch.evaluate(CompiledExpression<double>(expr), "test_output.npy", 1000);
+    assert(report.points == points);
+
+    MappedColumn result("test_output.npy");
+    assert(result.size() == points && !result.single_precision());
+    for (size_t i = 0; i < points; ++i) {
+        assert(std::abs(result.doubles()[i] - expr.eval({{"x", xs[i]}, {"y", ys[i]}})) < 1e-12);
+    }
+    std::remove("test_column_x.bin");
+    std::remove("test_column_y.npy");
+    std::remove("test_output.npy");
+    std::cout << "test_columnar_batch: OK\n";
+}
+
+// Тест для проверки оптимизации насыщением e-графа
+void test_egraph_optimizer() {
+    // Производная x ^ x: x * (1 / x) сокращается, умножение на 1 исчезает
+    Expression<double> expr = "x"_var ^ "x"_var;
+    Expression<double> derivative = expr.diff("x");
+    Expression<double> optimized = optimize(derivative);
+    std::map<std::string, double> context = {{"x", 1.7}};
+    assert(std::abs(optimized.eval(context) - derivative.eval(context)) < 1e-12);
+    assert(optimized.to_string().size() < derivative.to_string().size());
+    assert(optimized.to_string().find('/') == std::string::npos);
+
+    // Сокращение exp/ln, тождества и вынесение общего множителя
+    assert(optimize(Expression<double>::from_string("ln(exp(x)) * 1 + 0")).to_string() == "x");
+    Expression<double> factored = optimize(Expression<double>::from_string("sin(x) * y + sin(x) * x"));
+    assert(factored.to_string().find("sin") == factored.to_string().rfind("sin"));
+    context = {{"x", 0.3}, {"y", 2.0}};
+    assert(std::abs(factored.eval(context) - (std::sin(0.3) * 2.3)) < 1e-12);
+
+    // ln(a ^ b) раскрывается только для положительного основания
+    Expression<double> even = Expression<double>::from_string("ln(x ^ 4)");
+    assert(optimize(even).eval({{"x", -1.0}}) == 0.0);
+    Expression<double> positive = Expression<double>::from_string("ln(exp(x) ^ 3)");
+    assert(optimize(positive).to_string().find("ln") == std::string::npos);
+    assert(std::abs(optimize(positive).eval({{"x", -0.5}}) + 1.5) < 1e-12);
+
+    // Произведение одинаковых составных множителей: объединения при восстановлении конгруэнтности
+    Expression<double> square = Expression<double>::from_string("(x + 1) * (x + 1)").diff("x");
+    assert(std::abs(optimize(square).eval({{"x", 0.25}}) - 2.5) < 1e-12);
+    Expression<double> cube = Expression<double>::from_string("sin(x * y) * sin(x * y) * sin(x * y)").diff("y");
+    context = {{"x", 0.4}, {"y", 1.1}};
+    assert(std::abs(optimize(cube).eval(context) - cube.eval(context)) < 1e-12);
+
+    // Бюджет ограничивает размер графа, результат остаётся эквивалентным
+    Expression<double> large = Expression<double>::from_string("(x + y) ^ 3 * x - 4 * x ^ 2 / y").diff("x").diff("y");
+    EGraphBudget budget;
+    budget.max_nodes = 500;
+    Expression<double> bounded = optimize(large, budget);
+    context = {{"x", 1.5}, {"y", 0.5}};
+    assert(std::abs(bounded.eval(context) - large.eval(context)) < 1e-9 * std::abs(large.eval(context)));
+    CompiledExpression<double> before(large), after(bounded);
+    assert(after.instructions().size() <= before.instructions().size());
+    std::cout << "test_egraph_optimizer: OK\n";
+}
+
+// Тест для проверки пропуска поддеревьев, не зависящих от переменной
+void test_dependency_diff() {
+    Expression<double> expr = Expression<double>::from_string("sin(y) * x ^ 2 + exp(y) / (y + 1)");
+    assert(expr.depends_on("x") && expr.depends_on("y") && !expr.depends_on("unknown"));
+    assert(expr.diff("unknown").to_string() == "0");
+    Expression<double> derivative = expr.diff("x");
+    assert(derivative.to_string() == "(sin(y) * ((2 * (x ^ 1)) * 1))");
+    assert(!derivative.depends_on("unknown"));
+
+    // Постоянный показатель-выражение и постоянное основание
+    std::map<std::string, double> context = {{"x", 1.3}, {"y", 0.7}};
+    Expression<double> power = ("x"_var ^ "y"_var) + (2.0_val ^ "x"_var);
+    double h = 1e-6;
+    double numeric = (power.eval({{"x", 1.3 + h}, {"y", 0.7}}) - power.eval({{"x", 1.3 - h}, {"y", 0.7}})) / (2 * h);
+    assert(std::abs(power.diff("x").eval(context) - numeric) < 1e-6);
+    assert(power.diff("x").to_string().find("ln(x)") == std::string::npos);
+
+    // Сотни переменных: производная по каждой строится только из зависящих от неё слагаемых
+    Expression<double> sum = 0.0_val;
+    for (int i = 0; i < 300; ++i) {
+        sum = sum + Expression<double>("v" + std::to_string(i)) * Expression<double>(double(i));
+    }
+    std::map<std::string, double> values;
+    for (int i = 0; i < 300; ++i) {
+        values["v" + std::to_string(i)] = 1.0;
+    }
+    assert(sum.dependencies().size() == 300);
+    assert(sum.diff("v3").eval(values) == 3.0);
+    assert(sum.diff("v3").to_string() == "(1 * 3)");
+    assert(sum.diff("v275").to_string() == "(1 * 275)");
+    std::cout << "test_dependency_diff: OK\n";
+}
+
 // Основная функция для запуска всех тестов
 int main() {
     test_eval_addition();
@@ -127,6 +623,19 @@ int main() {
     test_differentiation_addition();
     test_parse_expression();
     test_differentiation_power();  // Добавленный тест с отладкой
+    test_polynomial_horner();
+    test_compiled_eval();
+    test_sparse_jacobian();
+    test_mixed_precision();
+    test_mixed_precision_speed();
+    test_expression_cache();
+    test_formula_pipeline();
+    test_compiled_slots();
+    test_sharded_eval();
+    test_polynomial_diff();
+    test_columnar_batch();
+    test_egraph_optimizer();
+    test_dependency_diff();
     
     std::cout << "All tests passed successfully!\n";
     return 0;